@@ -67,6 +67,34 @@ struct DescriptorBuilder {
 };
 
 //Pipelines
+/*
+everything needed to compile a pipeline as plain data, so any worker can build it with its own PipelineBuilder
+comp_path set makes it a compute pipeline and the graphics state is ignored
+*/
+struct PipelineDesc {
+	std::string name;
+	const char* vert_path = nullptr;
+	const char* frag_path = nullptr;
+	const char* comp_path = nullptr;
+	VkPipelineLayout layout = VK_NULL_HANDLE;
+	VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+	VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	bool depth_test = true;
+	VkBool32 depth_write = VK_TRUE;
+	VkCompareOp depth_op = VK_COMPARE_OP_GREATER_OR_EQUAL;	//reversed-z
+	bool blending = false;
+	VkBlendFactor dst_blend_factor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	VkFormat color_format = VK_FORMAT_UNDEFINED;
+	VkFormat depth_format = VK_FORMAT_UNDEFINED;
+	VkPipelineCreateFlags flags = 0;
+	VkShaderStageFlagBits spec_stage = VK_SHADER_STAGE_FRAGMENT_BIT;	//stage the specialization applies to
+	std::vector<VkSpecializationMapEntry> spec_entries;
+	std::vector<uint8_t> spec_data;
+	bool first_frame = true;		//blocks until compiled when there is no fallback, otherwise picked up when ready
+};
+
 struct PipelineBuilder {
 	std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
 	VkPipelineInputAssemblyStateCreateInfo input_assembly;
@@ -77,6 +105,7 @@ struct PipelineBuilder {
 	VkPipelineRenderingCreateInfo rendering_info;
 	VkFormat color_attachment_format;
 	VkPipelineLayout pipeline_layout;
+	VkPipelineCreateFlags flags;
 
 	PipelineBuilder() { clear(); };
 
@@ -103,8 +132,13 @@ struct PipelineBuilder {
 		color_attachment_format = VK_FORMAT_UNDEFINED;
 
 		pipeline_layout = {};
+		flags = 0;
 	}
-	void set_shaders(VkShaderModule vertex_shader, VkShaderModule fragment_shader) {
+	/*
+	specialization info must outlive build_pipeline
+	*/
+	void set_shaders(VkShaderModule vertex_shader, VkShaderModule fragment_shader,
+		const VkSpecializationInfo* vertex_specialization = nullptr, const VkSpecializationInfo* fragment_specialization = nullptr) {
 		shader_stages.clear();
 		VkPipelineShaderStageCreateInfo vertex_info = {};
 		vertex_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -112,6 +146,7 @@ struct PipelineBuilder {
 		vertex_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
 		vertex_info.module = vertex_shader;
 		vertex_info.pName = "main";
+		vertex_info.pSpecializationInfo = vertex_specialization;
 
 		VkPipelineShaderStageCreateInfo fragment_info = {};
 		fragment_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -119,6 +154,7 @@ struct PipelineBuilder {
 		fragment_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		fragment_info.module = fragment_shader;
 		fragment_info.pName = "main";
+		fragment_info.pSpecializationInfo = fragment_specialization;
 
 		shader_stages = {vertex_info, fragment_info};
 	}
@@ -192,7 +228,34 @@ struct PipelineBuilder {
 	void set_depth_attachment_format(VkFormat format) {
 		rendering_info.depthAttachmentFormat = format;
 	}
-	VkPipeline build_pipeline(VkDevice device) {
+	/*
+	fixed function state of desc, shaders are set separately
+	*/
+	void set_state(const PipelineDesc& desc) {
+		pipeline_layout = desc.layout;
+		flags = desc.flags;
+		set_topology(desc.topology);
+		set_polygon_mode(desc.polygon_mode);
+		set_culling_mode(desc.cull_mode, desc.front_face);
+		set_multisampling_none();
+		if (desc.blending) {
+			enable_blending(desc.dst_blend_factor);
+		}
+		else {
+			disable_blending();
+		}
+		if (desc.depth_test) {
+			enable_depthtest(desc.depth_write, desc.depth_op);
+		}
+		else {
+			disable_depthtest();
+		}
+		if (desc.color_format != VK_FORMAT_UNDEFINED) {
+			set_color_attachment_format(desc.color_format);
+		}
+		set_depth_attachment_format(desc.depth_format);
+	}
+	VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE) {
 		VkPipelineViewportStateCreateInfo viewport_state = {};
 		viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 		viewport_state.pNext = nullptr;
@@ -222,6 +285,7 @@ struct PipelineBuilder {
 		graphics_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 		//set pnext to render info for dynamic rendering
 		graphics_pipeline_info.pNext = &rendering_info;
+		graphics_pipeline_info.flags = flags;
 
 		graphics_pipeline_info.stageCount = (uint32_t)shader_stages.size();
 		graphics_pipeline_info.pStages = shader_stages.data();
@@ -236,7 +300,7 @@ struct PipelineBuilder {
 		graphics_pipeline_info.pDynamicState = &dynamic_state_info;
 
 		VkPipeline pipeline;
-		if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphics_pipeline_info, nullptr, &pipeline) != VK_SUCCESS) {
+		if (vkCreateGraphicsPipelines(device, cache, 1, &graphics_pipeline_info, nullptr, &pipeline) != VK_SUCCESS) {
 			return VK_NULL_HANDLE; // failed to create graphics pipeline
 		}
 		else {
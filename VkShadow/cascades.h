@@ -0,0 +1,123 @@
+#pragma once
+//Cascaded shadow maps
+/*
+the camera frustum up to the shadow distance is split into slices, each covered by an orthographic
+projection of the directional sun and rendered into its own layer of shadowmap_image
+splits blend logarithmic & uniform spacing (practical split scheme), lambda 1 is fully logarithmic
+each slice is bounded by a sphere so its projection keeps the same size as the camera turns, and its
+center is snapped to whole shadow texels in light space so edges don't shimmer as the camera moves
+a snapped cascade is bit identical until the camera crosses a texel, which is what lets shadow_cache skip it
+fit only updates fitted, a cascade's projection is what it was last drawn with until it is published, see shadow_scheduler.h
+*/
+struct ShadowCascade {
+	glm::mat4 view_proj;
+	float split_near;		//view space distance
+	float split_far;
+	float radius;			//bounding sphere of the slice, half the projection's width
+	float texel_size;		//world units per shadow texel
+	glm::vec3 center;		//world space center of the bounding sphere
+};
+
+struct CascadedShadows {
+	uint32_t count = MAX_SHADOW_CASCADES;
+	uint32_t resolution = 1024;		//per layer
+	float lambda = 0.75f;
+	float blend = 0.1f;				//fraction of each cascade faded into the next at its far end
+	float caster_margin = 10.0f;	//projection extended toward the sun so casters outside the slice still cast
+	ShadowCascade cascades[MAX_SHADOW_CASCADES] = {};		//published, what the shadow map & the UBO hold
+	ShadowCascade fitted[MAX_SHADOW_CASCADES] = {};			//the current view's, published when redrawn
+
+	//shadow draws recorded per cascade last frame & batches culled from a cascade
+	uint32_t casters[MAX_SHADOW_CASCADES] = {};
+	uint32_t culled = 0;
+
+	/*
+	view space distance of split i out of count, 0 is the near plane & count the far plane
+	*/
+	float split(uint32_t i, float near_plane, float far_plane) const {
+		float p = (float)i / count;
+		float log_split = near_plane * std::pow(far_plane / near_plane, p);
+		float uniform_split = near_plane + (far_plane - near_plane) * p;
+		return lambda * log_split + (1.0f - lambda) * uniform_split;
+	}
+
+	/*
+	fits every cascade to the camera into fitted, fov in radians, light_dir points from the scene toward the sun
+	reversed Z like the camera, the side nearest the sun is depth 1
+	*/
+	void fit(const glm::mat4& view, float fov, float aspect, float near_plane, float far_plane, glm::vec3 light_dir) {
+		glm::mat4 inv_view = glm::inverse(view);
+		float tan_y = std::tan(fov * 0.5f);
+		float tan_x = tan_y * aspect;
+		glm::vec3 up = std::abs(light_dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::mat4 light_rotation = glm::lookAt(glm::vec3(0.0f), -light_dir, up);
+
+		for (uint32_t i = 0; i < count; i++) {
+			ShadowCascade& cascade = fitted[i];
+			cascade.split_near = split(i, near_plane, far_plane);
+			cascade.split_far = split(i + 1, near_plane, far_plane);
+
+			glm::vec3 corners[8];
+			glm::vec3 center = glm::vec3(0.0f);
+			for (uint32_t c = 0; c < 8; c++) {
+				float d = (c & 4) ? cascade.split_far : cascade.split_near;
+				glm::vec4 corner = glm::vec4((c & 1 ? 1.0f : -1.0f) * tan_x * d, (c & 2 ? 1.0f : -1.0f) * tan_y * d, -d, 1.0f);
+				corners[c] = glm::vec3(inv_view * corner);
+				center += corners[c] / 8.0f;
+			}
+			float radius = 0.0f;
+			for (const glm::vec3& corner : corners) {
+				radius = std::max(radius, glm::distance(center, corner));
+			}
+			//rounded up so float noise in the corners can't change the projection's size
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+
+			//snapped on all three axes, depth by the same step, so every world point keeps its texel & depth
+			float texel_size = 2.0f * radius / resolution;
+			glm::vec3 light_center = glm::vec3(light_rotation * glm::vec4(center, 1.0f));
+			light_center = glm::floor(light_center / texel_size) * texel_size;
+
+			glm::vec3 light_eye = light_center + glm::vec3(0.0f, 0.0f, radius + caster_margin);
+			glm::mat4 light_view = glm::translate(glm::mat4(1.0f), -light_eye) * light_rotation;
+			glm::mat4 light_proj = glm::orthoZO(-radius, radius, -radius, radius, 2.0f * radius + caster_margin, 0.0f);
+			light_proj[1][1] *= -1;
+
+			cascade.view_proj = light_proj * light_view;
+			cascade.radius = radius;
+			cascade.texel_size = texel_size;
+			cascade.center = center;
+		}
+	}
+
+	/*
+	true when cascade i was refit since it was last published
+	*/
+	bool pending(uint32_t i) const {
+		return fitted[i].view_proj != cascades[i].view_proj;
+	}
+
+	/*
+	how far cascade i's slice has moved from the published projection, as a fraction of its radius
+	*/
+	float drift(uint32_t i) const {
+		return glm::distance(fitted[i].center, cascades[i].center) / std::max(fitted[i].radius, 1e-4f);
+	}
+
+	void publish(uint32_t i) {
+		cascades[i] = fitted[i];
+	}
+
+	/*
+	conservative box test against cascade i, its projection is affine so the box stays a box in clip space
+	*/
+	bool intersects(uint32_t i, glm::vec3 bounds_min, glm::vec3 bounds_max) const {
+		const glm::mat4& m = cascades[i].view_proj;
+		glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+		glm::vec3 extent = (bounds_max - bounds_min) * 0.5f;
+		glm::vec3 clip_center = glm::vec3(m * glm::vec4(center, 1.0f));
+		glm::vec3 clip_extent = glm::abs(glm::vec3(m[0])) * extent.x + glm::abs(glm::vec3(m[1])) * extent.y + glm::abs(glm::vec3(m[2])) * extent.z;
+		return clip_center.x - clip_extent.x <= 1.0f && clip_center.x + clip_extent.x >= -1.0f
+			&& clip_center.y - clip_extent.y <= 1.0f && clip_center.y + clip_extent.y >= -1.0f
+			&& clip_center.z - clip_extent.z <= 1.0f && clip_center.z + clip_extent.z >= 0.0f;
+	}
+};
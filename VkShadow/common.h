@@ -30,6 +30,63 @@ enum MESHTYPE
 	UNDEFINED
 };
 
+//Index into Engine::pipeline_table, also the pipeline field of draw sort keys
+enum PIPELINEID
+{
+	MESH_PIPELINE_ID,
+	SHADOW_PIPELINE_ID,
+	DEPTH_PREPASS_PIPELINE_ID,
+	MESH_EQUAL_PIPELINE_ID,		//mesh shading with depth writes off and an EQUAL test, after the pre-pass
+	POINT_SHADOW_PIPELINE_ID,	//shadow.vert with point_shadow.frag writing linear distance to the light
+	PIPELINE_ID_COUNT
+};
+
+//mesh.frag specialization, values match the constants declared in the shader
+enum SHADOWMODE
+{
+	SHADOW_OFF,
+	SHADOW_HARD,		//one manual depth compare
+	SHADOW_PCF,			//one hardware compare, bilinear 2x2 PCF
+	SHADOW_POISSON,		//rotated Poisson disk of hardware compares
+	SHADOW_PCSS,		//gathered blocker search scales the Poisson disk to the penumbra
+	SHADOW_EVSM,		//exponential variance, moments blurred & mipmapped in compute
+	SHADOW_MODE_COUNT
+};
+
+enum LIGHTINGMODE
+{
+	LIGHTING_PHONG,
+	LIGHTING_DIFFUSE,
+	LIGHTING_NORMALS,		//debug view, world normals as colour
+	LIGHTING_CASCADES,		//debug view, Phong tinted by shadow cascade
+	LIGHTING_MODE_COUNT
+};
+
+//the limits, light structs & UBO below are declared again for the shaders in shaders/common.glsl
+//layers of shadowmap_image & size of the UBO's cascade arrays, the count in use is set at startup
+const uint32_t MAX_SHADOW_CASCADES = 4;
+//size of the UBO's spot light array, each shadowed one owns a tile of the shadow atlas
+const uint32_t MAX_SPOT_LIGHTS = 32;
+//size of the UBO's point light array, each one owns 6 layers of point_image
+const uint32_t MAX_POINT_LIGHTS = 4;
+//first draw layer of the point light faces, layer POINT_LAYER_BASE + 6 * light + face
+const uint32_t POINT_LAYER_BASE = MAX_SHADOW_CASCADES + MAX_SPOT_LIGHTS;
+
+//field i is mesh.frag's constant_id i
+struct MeshShadingOptions {
+	uint32_t shadow_mode = SHADOW_HARD;
+	VkBool32 border_bypass = VK_TRUE;	//outside the shadowmap's border counts as lit
+	float depth_bias = 0.001f;
+	uint32_t lighting_mode = LIGHTING_PHONG;
+	VkBool32 cascade_blend = VK_TRUE;	//fade into the next cascade near a split instead of a hard seam
+	uint32_t filter_taps = 16;			//Poisson & PCSS filter taps, up to 32
+	float filter_radius = 1.5f;			//Poisson disk radius in shadow texels
+	uint32_t blocker_taps = 8;			//PCSS blocker search gathers, 4 texels each
+	float light_size = 0.02f;			//PCSS, tangent of the sun's angular radius
+	float evsm_exponent = 5.0f;			//squared moments must fit in 16 bit floats, 5.54 at most
+	float light_bleed = 0.2f;			//EVSM, fraction of the Chebyshev bound cut off
+};
+
 struct MeshResource {
 	std::string file_path;
 	glm::mat4 model_mat;
@@ -41,6 +98,11 @@ struct {
 	const char* mesh_frag = "../../shaders/spirv/mesh.frag.spv";
 	const char* shadow_vert = "../../shaders/spirv/shadow.vert.spv";
 	const char* shadow_frag = "../../shaders/spirv/shadow.frag.spv";
+	const char* point_shadow_frag = "../../shaders/spirv/point_shadow.frag.spv";
+	const char* depth_vert = "../../shaders/spirv/depth.vert.spv";
+	const char* tonemap_comp = "../../shaders/spirv/tonemap.comp.spv";
+	const char* moments_blur_comp = "../../shaders/spirv/moments_blur.comp.spv";
+	const char* depth_reduce_comp = "../../shaders/spirv/depth_reduce.comp.spv";
 } shader_paths;
 
 struct {
@@ -76,12 +138,40 @@ struct BufferData {
 	VmaAllocationInfo info;
 };
 
+//GPU mesh asset, shared by every instance that references it
 struct MeshData {
 	BufferData index_buffer;
 	BufferData vertex_buffer;
 	VkDeviceAddress vertex_buffer_address;
+	uint32_t index_count;
+	glm::vec3 bounds_min;		//object space
+	glm::vec3 bounds_max;
+};
+
+struct MeshInstance {
+	uint32_t mesh_id;
 	glm::mat4 model_mat;
+	bool dynamic;		//moves every frame, drawn over the cached static shadow depth instead of into it
+};
+
+//One instanced draw, instances [first_instance, first_instance + instance_count) of the instance buffer
+struct DrawBatch {
+	VkBuffer index_buffer;
+	VkDeviceAddress vertex_buffer_address;
 	uint32_t index_count;
+	uint32_t mesh_id;
+	uint32_t material_id;
+	uint32_t first_instance;
+	uint32_t instance_count;
+	bool dynamic;			//instances of the mesh that move, batched apart from its static ones
+	glm::vec3 center;		//mean instance position, used for depth sorting
+	glm::vec3 bounds_min;	//world space box around every instance, used for cascade culling
+	glm::vec3 bounds_max;
+};
+
+struct PipelineBinding {
+	VkPipeline pipeline;
+	VkPipelineLayout layout;
 };
 
 struct PerFrameData {
@@ -91,6 +181,70 @@ struct PerFrameData {
 	VkFence render_fence;
 	VkSemaphore render_semaphore;
 	VkSemaphore swapcahin_semaphore;
+
+	//versions last written to this frame's slice of frame_ring, stale fields are rewritten
+	uint64_t scene_version;		//instance transforms sorted by mesh
+	uint64_t camera_version;
+	uint64_t light_version;
+	uint64_t material_version;
+	uint64_t spot_light_version;
+	uint64_t point_light_version;
+	uint64_t descriptor_version;	//descriptor buffer copy of the global set
+	uint32_t shaded_shadow_mode;	//shadow mode the geo pass was recorded with, SHADOW_MODE_COUNT while unknown
+	uint32_t shadow_draws;			//shadow map, atlas & cube draws recorded, what its shadow zones are charged to
+
+	//one pool per worker thread, each worker records a slice of the shadow & geo passes
+	std::vector<VkCommandPool> worker_pools;
+	std::vector<VkCommandBuffer> worker_shadow_cmds;
+	std::vector<VkCommandBuffer> worker_shadow_dynamic_cmds;
+	std::vector<VkCommandBuffer> worker_atlas_cmds;
+	std::vector<VkCommandBuffer> worker_point_cmds;
+	std::vector<VkCommandBuffer> worker_prepass_cmds;
+	std::vector<VkCommandBuffer> worker_geo_cmds;
+
+	//min & max visible view depth written by this frame's depth_reduce pass, read back after its fence
+	BufferData depth_bounds_buffer;
+	bool depth_bounds_pending;
+
+	//latency from the start of draw() until this frame's fence is seen signalled
+	std::chrono::high_resolution_clock::time_point cpu_start;
+	bool awaiting_completion;
+};
+
+//chosen per machine from the command line, see main.cpp
+struct EngineConfig {
+	uint32_t frames_in_flight = 2;		//1 to 4
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;	//falls back to FIFO if the surface lacks it
+	bool dynamic_resolution = false;
+	float target_frame_ms = 16.6f;		//GPU budget the resolution scaler aims for
+	float min_render_scale = 0.5f;
+	float shadow_bias = 0.001f;
+	bool descriptor_buffer = true;		//VK_EXT_descriptor_buffer for the global set where supported
+	uint32_t shadow_cascades = 4;		//2 to MAX_SHADOW_CASCADES
+	bool shadow_cache = true;			//only redraw shadow cascades whose casters or projection changed
+	uint32_t shadow_mode = SHADOW_PCF;
+	uint32_t filter_taps = 16;
+	uint32_t spot_lights = 24;			//shadowed spot lights sharing the atlas, up to MAX_SPOT_LIGHTS
+	uint32_t point_lights = 2;			//cube shadowed point lights, up to MAX_POINT_LIGHTS
+	bool sdsm = true;					//fit the cascades to the visible depth range read back from the GPU
+	float shadow_budget_ms = 1.0f;		//GPU time per frame for shadow updates that can wait, 0 redraws them all at once
+};
+
+struct FrameStats {
+	uint32_t draw_calls;
+	uint32_t instances;
+	uint32_t binds;			//pipeline, descriptor set & index buffer binds
+	float sort_time_us;
+	float record_time_us;
+	uint32_t barriers;
+	uint32_t cpu_write_bytes;	//uniform & instance data written to frame_ring this frame
+	float render_scale;
+	float gpu_frame_ms;			//last resolved, lags frames_in_flight frames behind
+	float descriptor_update_us;
+	float descriptor_bind_us;
+	uint32_t descriptor_binds;
+	uint32_t shadow_views;		//cascades, spot tiles & point cubes redrawn this frame
+	float shadow_estimate_ms;	//scheduler's estimate of their GPU time
 };
 
 struct TransitionData {
@@ -105,17 +259,37 @@ struct TransitionData {
 };
 
 //GPU DATA
+struct SpotLightData {
+	alignas(16)glm::mat4 view_proj;
+	alignas(16)glm::vec4 position_range;
+	alignas(16)glm::vec4 direction_cos_outer;
+	alignas(16)glm::vec4 color_cos_inner;
+	alignas(16)glm::vec4 atlas_rect;		//xy uv offset & zw uv scale of its tile, zw 0 when unshadowed
+};
+
+struct PointLightData {
+	alignas(16)glm::mat4 face_view_proj[6];
+	alignas(16)glm::vec4 position_range;
+	alignas(16)glm::vec4 color;
+};
+
 struct UniformBufferObject {
 	alignas(16)glm::mat4 view;
 	alignas(16)glm::mat4 proj;
 	alignas(16)glm::mat4 Q;
-	alignas(16)glm::mat4 light_view;
-	alignas(16)glm::mat4 light_proj;
-	alignas(16)glm::vec3 lightpos;
+	alignas(16)glm::vec3 eye_pos;
+	alignas(16)glm::mat4 cascade_view_proj[MAX_SHADOW_CASCADES];
+	alignas(16)glm::vec4 cascade_splits;	//view space far distance of each cascade
+	alignas(16)glm::vec4 cascade_params;	//x cascade count, y blend band as a fraction of a cascade, z near end of the first cascade
+	alignas(16)glm::vec3 light_dir;			//toward the sun
 	alignas(16)glm::vec3 lightcol;
 	alignas(16)glm::vec3 ka;
 	alignas(16)glm::vec3 kd;
 	alignas(16)glm::vec4 kss;
+	alignas(16)glm::vec4 spot_params;		//x spot light count, y one atlas texel in uv
+	SpotLightData spot_lights[MAX_SPOT_LIGHTS];
+	alignas(16)glm::vec4 point_params;		//x point light count, y one cube face texel in uv
+	PointLightData point_lights[MAX_POINT_LIGHTS];
 };
 /* TODO
 struct GeoUniformBufferObject {
@@ -137,11 +311,53 @@ struct ShadowmapUniformBufferObject {
 };
 */
 struct PushConstants {
-	alignas(16)glm::mat4 model;
-	alignas(16)VkDeviceAddress vb_addr;
+	alignas(8)VkDeviceAddress vb_addr;
+	alignas(8)VkDeviceAddress instance_addr;
+	alignas(4)uint32_t layer;		//shadow cascade the draw renders into, MAX_SHADOW_CASCADES + light for atlas tiles, POINT_LAYER_BASE + face for cube faces
 	//alignas(8) uint32_t material_index
 };
 
+struct TonemapPushConstants {
+	glm::vec2 uv_scale;			//draw_extent / draw_image extent
+	glm::ivec2 dst_extent;
+	float exposure;
+	uint32_t tonemap;			//0 copies draw_image unchanged, the same work as the blit
+};
+
+struct DepthReducePushConstants {
+	glm::ivec2 extent;			//draw_extent, the part of depth_image rendered this frame
+	float near_plane;
+	float far_plane;
+};
+
+struct MomentsPushConstants {
+	glm::ivec2 direction;		//blur axis in texels
+	uint32_t warp;				//1 reads shadow map depth & warps it into EVSM moments
+	float exponent;
+};
+
+//free fly, WASD/QE to move, hold the right mouse button to look
+struct Camera {
+	glm::vec3 pos;
+	float yaw;				//degrees, -90 looks down -z
+	float pitch;
+	float fov;				//vertical, degrees
+	float aspect;
+	float near_plane;
+	float far_plane;		//also the shadow distance covered by the cascades
+	float speed;			//units per second
+	float sensitivity;		//degrees per pixel
+	glm::dvec2 last_cursor;
+	bool looking;
+
+	glm::vec3 forward() const {
+		return glm::normalize(glm::vec3(
+			cos(glm::radians(pitch)) * cos(glm::radians(yaw)),
+			sin(glm::radians(pitch)),
+			cos(glm::radians(pitch)) * sin(glm::radians(yaw))));
+	}
+};
+
 struct Light {
 	glm::vec3 pos;
 	glm::vec3 col;
@@ -0,0 +1,148 @@
+#pragma once
+//Deferred deletion
+/*
+GPU objects are pushed tagged with the last frame that may have recorded them and destroyed once that
+frame's render_fence has been waited on, so nothing has to idle the device to free memory mid run
+frames retire in submission order, so entries are pushed & flushed in frame order from the front
+*/
+enum DELETIONTYPE
+{
+	DELETE_BUFFER,
+	DELETE_IMAGE,			//destroyed with its allocation if it owns one, bound images only free the VkImage
+	DELETE_IMAGE_VIEW,
+	DELETE_PIPELINE,
+	DELETE_ALLOCATION,		//raw VMA memory, e.g. an aliased transient block
+	DELETE_SWAPCHAIN,
+	DELETE_CALLBACK			//anything else, e.g. handing a descriptor set back for reuse
+};
+
+struct PendingDeletion {
+	uint64_t frame;
+	DELETIONTYPE type;
+	uint64_t handle;			//non-dispatchable handle
+	VmaAllocation allocation;
+	VkDeviceSize bytes;
+	std::function<void()> callback;
+};
+
+struct DeletionQueue {
+	VkDevice device = VK_NULL_HANDLE;
+	VmaAllocator allocator = VK_NULL_HANDLE;
+	std::deque<PendingDeletion> pending;
+
+	VkDeviceSize pending_bytes = 0;
+	VkDeviceSize peak_pending_bytes = 0;
+	uint64_t destroyed_count = 0;
+	VkDeviceSize destroyed_bytes = 0;
+
+	void init(VkDevice dev, VmaAllocator vma_allocator) {
+		device = dev;
+		allocator = vma_allocator;
+	}
+
+	void push_buffer(uint64_t frame, VkBuffer buffer, VmaAllocation allocation) {
+		push({ frame, DELETE_BUFFER, (uint64_t)buffer, allocation, allocation_size(allocation), nullptr });
+	}
+
+	/*
+	allocation is VK_NULL_HANDLE for images bound into memory owned elsewhere
+	*/
+	void push_image(uint64_t frame, VkImage image, VmaAllocation allocation) {
+		push({ frame, DELETE_IMAGE, (uint64_t)image, allocation, allocation_size(allocation), nullptr });
+	}
+
+	void push_image_view(uint64_t frame, VkImageView view) {
+		push({ frame, DELETE_IMAGE_VIEW, (uint64_t)view, VK_NULL_HANDLE, 0, nullptr });
+	}
+
+	void push_pipeline(uint64_t frame, VkPipeline pipeline) {
+		push({ frame, DELETE_PIPELINE, (uint64_t)pipeline, VK_NULL_HANDLE, 0, nullptr });
+	}
+
+	void push_allocation(uint64_t frame, VmaAllocation allocation) {
+		push({ frame, DELETE_ALLOCATION, 0, allocation, allocation_size(allocation), nullptr });
+	}
+
+	void push_swapchain(uint64_t frame, VkSwapchainKHR swapchain) {
+		push({ frame, DELETE_SWAPCHAIN, (uint64_t)swapchain, VK_NULL_HANDLE, 0, nullptr });
+	}
+
+	void push_callback(uint64_t frame, std::function<void()> callback) {
+		push({ frame, DELETE_CALLBACK, 0, VK_NULL_HANDLE, 0, std::move(callback) });
+	}
+
+	/*
+	destroys everything pushed at or before completed_frame
+	*/
+	void flush(uint64_t completed_frame) {
+		while (!pending.empty() && pending.front().frame <= completed_frame) {
+			destroy(pending.front());
+			pending.pop_front();
+		}
+	}
+
+	/*
+	shutdown, the device must be idle
+	*/
+	void flush_all() {
+		while (!pending.empty()) {
+			destroy(pending.front());
+			pending.pop_front();
+		}
+	}
+
+private:
+	VkDeviceSize allocation_size(VmaAllocation allocation) const {
+		if (allocation == VK_NULL_HANDLE) {
+			return 0;
+		}
+		VmaAllocationInfo info = {};
+		vmaGetAllocationInfo(allocator, allocation, &info);
+		return info.size;
+	}
+
+	void push(PendingDeletion&& entry) {
+		//keep the queue in frame order even if a caller tags an older frame
+		if (!pending.empty()) {
+			entry.frame = std::max(entry.frame, pending.back().frame);
+		}
+		pending_bytes += entry.bytes;
+		peak_pending_bytes = std::max(peak_pending_bytes, pending_bytes);
+		pending.push_back(std::move(entry));
+	}
+
+	void destroy(PendingDeletion& entry) {
+		switch (entry.type)
+		{
+		case DELETE_BUFFER:
+			vmaDestroyBuffer(allocator, (VkBuffer)entry.handle, entry.allocation);
+			break;
+		case DELETE_IMAGE:
+			if (entry.allocation != VK_NULL_HANDLE) {
+				vmaDestroyImage(allocator, (VkImage)entry.handle, entry.allocation);
+			}
+			else {
+				vkDestroyImage(device, (VkImage)entry.handle, nullptr);
+			}
+			break;
+		case DELETE_IMAGE_VIEW:
+			vkDestroyImageView(device, (VkImageView)entry.handle, nullptr);
+			break;
+		case DELETE_PIPELINE:
+			vkDestroyPipeline(device, (VkPipeline)entry.handle, nullptr);
+			break;
+		case DELETE_ALLOCATION:
+			vmaFreeMemory(allocator, entry.allocation);
+			break;
+		case DELETE_SWAPCHAIN:
+			vkDestroySwapchainKHR(device, (VkSwapchainKHR)entry.handle, nullptr);
+			break;
+		case DELETE_CALLBACK:
+			entry.callback();
+			break;
+		}
+		pending_bytes -= entry.bytes;
+		destroyed_bytes += entry.bytes;
+		destroyed_count++;
+	}
+};
@@ -0,0 +1,110 @@
+#pragma once
+//Descriptor buffer
+/*
+VK_EXT_descriptor_buffer backend for the global set, descriptors are written straight into mapped memory
+and bound by offset instead of allocated from a pool and updated through vkUpdateDescriptorSets
+holds one copy of the set per frame in flight, a copy is only rewritten after its frame's fence
+dynamic uniform buffers don't exist here, each copy points its UBO at the frame's ring slice instead
+*/
+struct DescriptorBuffer {
+	PFN_vkGetDescriptorSetLayoutSizeEXT get_layout_size = nullptr;
+	PFN_vkGetDescriptorSetLayoutBindingOffsetEXT get_binding_offset = nullptr;
+	PFN_vkGetDescriptorEXT get_descriptor = nullptr;
+	PFN_vkCmdBindDescriptorBuffersEXT cmd_bind_buffers = nullptr;
+	PFN_vkCmdSetDescriptorBufferOffsetsEXT cmd_set_offsets = nullptr;
+	VkPhysicalDeviceDescriptorBufferPropertiesEXT properties = {};
+
+	BufferData buffer = {};
+	VkDeviceAddress address = 0;
+	VkDeviceSize set_size = 0;		//layout size rounded up to descriptorBufferOffsetAlignment
+	uint32_t set_count = 0;
+
+	/*
+	extension entry points aren't exported by the loader, false if the device doesn't provide them
+	*/
+	bool load(VkDevice device, VkPhysicalDevice phys_device) {
+		get_layout_size = (PFN_vkGetDescriptorSetLayoutSizeEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutSizeEXT");
+		get_binding_offset = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+		get_descriptor = (PFN_vkGetDescriptorEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorEXT");
+		cmd_bind_buffers = (PFN_vkCmdBindDescriptorBuffersEXT)vkGetDeviceProcAddr(device, "vkCmdBindDescriptorBuffersEXT");
+		cmd_set_offsets = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)vkGetDeviceProcAddr(device, "vkCmdSetDescriptorBufferOffsetsEXT");
+
+		properties = {};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT;
+		VkPhysicalDeviceProperties2 properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties2.pNext = &properties;
+		vkGetPhysicalDeviceProperties2(phys_device, &properties2);
+
+		return get_layout_size && get_binding_offset && get_descriptor && cmd_bind_buffers && cmd_set_offsets;
+	}
+
+	void create(VkDevice device, VmaAllocator allocator, VkDescriptorSetLayout layout, uint32_t count) {
+		VkDeviceSize layout_size = 0;
+		get_layout_size(device, layout, &layout_size);
+		VkDeviceSize alignment = std::max<VkDeviceSize>(properties.descriptorBufferOffsetAlignment, 1);
+		set_size = (layout_size + alignment - 1) / alignment * alignment;
+		set_count = count;
+
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.pNext = nullptr;
+		buffer_info.size = set_size * set_count;
+		buffer_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT
+			| VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+		VmaAllocationCreateInfo allocation_info = {};
+		allocation_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		allocation_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+		VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &allocation_info, &buffer.buffer, &buffer.allocation, &buffer.info));
+
+		VkBufferDeviceAddressInfo addr_info = {};
+		addr_info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+		addr_info.buffer = buffer.buffer;
+		address = vkGetBufferDeviceAddress(device, &addr_info);
+	}
+
+	void destroy(VmaAllocator allocator) {
+		if (buffer.buffer != VK_NULL_HANDLE) {
+			vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+		}
+		buffer = {};
+		address = 0;
+	}
+
+	VkDeviceSize set_offset(uint32_t index) const {
+		return set_size * index;
+	}
+
+	/*
+	writes one descriptor of set index at binding, size comes from the descriptor type's property
+	*/
+	void write(VkDevice device, VkDescriptorSetLayout layout, uint32_t index, uint32_t binding, const VkDescriptorGetInfoEXT& info, size_t size) const {
+		VkDeviceSize binding_offset = 0;
+		get_binding_offset(device, layout, binding, &binding_offset);
+		uint8_t* dst = (uint8_t*)buffer.info.pMappedData + set_offset(index) + binding_offset;
+		get_descriptor(device, &info, size, dst);
+	}
+
+	void flush(VmaAllocator allocator, uint32_t index) const {
+		vmaFlushAllocation(allocator, buffer.allocation, set_offset(index), set_size);
+	}
+
+	/*
+	the buffer binding is per command buffer, offsets then pick the set copy per layout change
+	*/
+	void bind_buffer(VkCommandBuffer cmd) const {
+		VkDescriptorBufferBindingInfoEXT binding_info = {};
+		binding_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT;
+		binding_info.pNext = nullptr;
+		binding_info.address = address;
+		binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+		cmd_bind_buffers(cmd, 1, &binding_info);
+	}
+
+	void bind_set(VkCommandBuffer cmd, VkPipelineBindPoint bind_point, VkPipelineLayout layout, uint32_t index) const {
+		uint32_t buffer_index = 0;
+		VkDeviceSize offset = set_offset(index);
+		cmd_set_offsets(cmd, bind_point, layout, 0, 1, &buffer_index, &offset);
+	}
+};
@@ -0,0 +1,145 @@
+#pragma once
+//Draw list
+
+enum DRAWPASS
+{
+	SHADOW_PASS,			//static casters, only for cascades shadow_cache marked dirty
+	SHADOW_DYNAMIC_PASS,	//moving casters, every frame
+	SPOT_SHADOW_PASS,		//casters of the spot lights whose atlas tiles are redrawn, material is the light
+	POINT_SHADOW_PASS,		//casters of the dirty point light cube faces, material is the face layer
+	DEPTH_PREPASS,
+	GEO_PASS
+};
+
+/*
+64 bit sort key, most significant first
+| pass 4 | pipeline 8 | material 12 | mesh 16 | depth 24 |
+*/
+struct DrawCommand {
+	uint64_t key;
+	uint32_t batch;
+	uint32_t layer;		//shadow cascade, MAX_SHADOW_CASCADES + spot light or POINT_LAYER_BASE + 6 * point light + face, 0 for the other passes
+};
+
+struct DrawList {
+	std::vector<DrawCommand> commands;
+	std::vector<DrawCommand> scratch;
+	float max_depth = 100.0f;		//view distance mapped to the largest depth key
+
+	static const uint32_t DEPTH_BITS = 24;
+	static const uint32_t MESH_SHIFT = 24;
+	static const uint32_t MATERIAL_SHIFT = 40;
+	static const uint32_t PIPELINE_SHIFT = 52;
+	static const uint32_t PASS_SHIFT = 60;
+
+	/*
+	depth01 is the normalized view distance, smaller sorts first (front to back)
+	*/
+	static uint64_t make_key(DRAWPASS pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth01) {
+		uint64_t max_depth = (1ull << DEPTH_BITS) - 1;
+		uint64_t depth = (uint64_t)(std::clamp(depth01, 0.0f, 1.0f) * (float)max_depth);
+
+		uint64_t key = 0;
+		key |= ((uint64_t)pass & 0xF) << PASS_SHIFT;
+		key |= ((uint64_t)pipeline & 0xFF) << PIPELINE_SHIFT;
+		key |= ((uint64_t)material & 0xFFF) << MATERIAL_SHIFT;
+		key |= ((uint64_t)mesh & 0xFFFF) << MESH_SHIFT;
+		key |= depth;
+		return key;
+	}
+	static DRAWPASS key_pass(uint64_t key) {
+		return (DRAWPASS)(key >> PASS_SHIFT);
+	}
+	static uint32_t key_pipeline(uint64_t key) {
+		return (uint32_t)((key >> PIPELINE_SHIFT) & 0xFF);
+	}
+
+	void clear() {
+		commands.clear();
+	}
+
+	void push(uint64_t key, uint32_t batch, uint32_t layer = 0) {
+		commands.push_back({ key, batch, layer });
+	}
+
+	/*
+	LSD radix sort, 8 bits per pass
+	all histograms are built in one read, passes where every key shares the same byte are skipped
+	*/
+	void sort() {
+		size_t count = commands.size();
+		if (count < 2) {
+			return;
+		}
+		scratch.resize(count);
+
+		uint32_t histograms[8][256] = {};
+		for (const DrawCommand& c : commands) {
+			for (uint32_t b = 0; b < 8; b++) {
+				histograms[b][(c.key >> (b * 8)) & 0xFF]++;
+			}
+		}
+
+		DrawCommand* src = commands.data();
+		DrawCommand* dst = scratch.data();
+		for (uint32_t b = 0; b < 8; b++) {
+			uint32_t shift = b * 8;
+			uint32_t* histogram = histograms[b];
+			if (histogram[(src[0].key >> shift) & 0xFF] == count) {
+				continue;
+			}
+
+			uint32_t sum = 0;
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t bucket = histogram[i];
+				histogram[i] = sum;
+				sum += bucket;
+			}
+			for (size_t i = 0; i < count; i++) {
+				uint32_t digit = (src[i].key >> shift) & 0xFF;
+				dst[histogram[digit]++] = src[i];
+			}
+			std::swap(src, dst);
+		}
+
+		if (src != commands.data()) {
+			commands.swap(scratch);
+		}
+	}
+
+	/*
+	contiguous range of sorted commands belonging to pass
+	*/
+	std::span<const DrawCommand> pass_range(DRAWPASS pass) const {
+		auto first = std::lower_bound(commands.begin(), commands.end(), pass,
+			[](const DrawCommand& c, DRAWPASS p) { return key_pass(c.key) < p; });
+		auto last = std::upper_bound(first, commands.end(), pass,
+			[](DRAWPASS p, const DrawCommand& c) { return p < key_pass(c.key); });
+		return std::span<const DrawCommand>(first, last);
+	}
+
+	/*
+	contiguous range of passes first to last inclusive
+	*/
+	std::span<const DrawCommand> pass_range(DRAWPASS first, DRAWPASS last) const {
+		std::span<const DrawCommand> first_range = pass_range(first);
+		std::span<const DrawCommand> last_range = pass_range(last);
+		return std::span<const DrawCommand>(first_range.data(), last_range.data() + last_range.size());
+	}
+};
+
+//Last bound state while recording, used to skip redundant binds
+struct BindState {
+	VkPipeline pipeline;
+	VkPipelineLayout layout;
+	VkDescriptorSet set;
+	VkBuffer index_buffer;
+	VkDeviceAddress vb_addr;
+	uint32_t layer;
+	bool descriptor_buffer_bound;
+
+	uint32_t binds;
+	uint32_t draws;
+	uint32_t descriptor_binds;
+	float descriptor_bind_us;
+};
@@ -6,9 +6,25 @@
 Engine::Engine() {
 	init();
 }
-Engine::Engine(int w, int h) 
-	: window_width(w),  window_height(h)
+Engine::Engine(int w, int h, EngineConfig engine_config) 
+	: window_width(w),  window_height(h), config(engine_config)
 {
+	frames_in_flight = std::clamp(config.frames_in_flight, 1u, 4u);
+	resolution_scaler.enabled = config.dynamic_resolution;
+	resolution_scaler.target_ms = config.target_frame_ms;
+	resolution_scaler.min_scale = std::clamp(config.min_render_scale, 0.1f, 1.0f);
+	mesh_shading.options.depth_bias = config.shadow_bias;
+	mesh_shading.options.shadow_mode = std::min(config.shadow_mode, (uint32_t)SHADOW_MODE_COUNT - 1);
+	mesh_shading.options.filter_taps = std::clamp(config.filter_taps, 1u, 32u);
+	cascades.count = std::clamp(config.shadow_cascades, 2u, MAX_SHADOW_CASCADES);
+	shadow_cache.enabled = config.shadow_cache;
+	shadow_atlas.enabled = config.shadow_cache;
+	point_shadows.enabled = config.shadow_cache;
+	sample_distribution.enabled = config.sdsm;
+	shadow_scheduler.enabled = config.shadow_budget_ms > 0.0f;
+	if (shadow_scheduler.enabled) {
+		shadow_scheduler.budget_ms = config.shadow_budget_ms;
+	}
 	init();
 }
 
@@ -18,42 +34,72 @@ Engine::~Engine() {
 		.model_mat = glm::mat4(0),
 		.type = MESHTYPE::UNDEFINED
 	};
-	mesh_queue.push(quit);
+	queue_mesh(quit);
+	workers.shutdown();
+	compile_workers.shutdown();
 
 	for (MeshData mesh : meshes) {
 		vmaDestroyBuffer(vma_allocator, mesh.vertex_buffer.buffer, mesh.vertex_buffer.allocation);
 		vmaDestroyBuffer(vma_allocator, mesh.index_buffer.buffer, mesh.index_buffer.allocation);
 	}
+	frame_ring.destroy(vma_allocator);
+	descriptor_buffer.destroy(vma_allocator);
 
+	pipeline_registry.destroy(device);
 	vkDestroyPipelineLayout(device, mesh_pipeline_layout, nullptr);
-	vkDestroyPipeline(device, mesh_pipeline, nullptr);
 	vkDestroyPipelineLayout(device, shadow_pipeline_layout, nullptr);
-	vkDestroyPipeline(device, shadow_pipeline, nullptr);
+	vkDestroyPipelineLayout(device, tonemap_pipeline_layout, nullptr);
+	vkDestroyPipelineLayout(device, moments_pipeline_layout, nullptr);
+	vkDestroyPipelineLayout(device, depth_reduce_pipeline_layout, nullptr);
+	if (!pipeline_cache.save(device)) {
+		LOG(1, "Failed to save pipeline cache to " + pipeline_cache.path + ".");
+	}
+	pipeline_cache.destroy(device);
+	profiler.destroy(device);
 
 	vkDestroyDescriptorPool(device, descriptor_builder.pool, nullptr);
 	vkDestroyDescriptorSetLayout(device, global_layout, nullptr);
+	vkDestroyDescriptorSetLayout(device, tonemap_set_layout, nullptr);
+	vkDestroyDescriptorSetLayout(device, moments_set_layout, nullptr);
+	vkDestroyDescriptorSetLayout(device, depth_reduce_set_layout, nullptr);
 
-	for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+	for (uint32_t i = 0; i < frames_in_flight; i++) {
 		vkDestroyFence(device, frames[i].render_fence, nullptr);
 		vkDestroySemaphore(device, frames[i].render_semaphore, nullptr);
 		vkDestroySemaphore(device, frames[i].swapcahin_semaphore, nullptr);
 
 		vkDestroyCommandPool(device, frames[i].command_pool, nullptr);
+		vmaDestroyBuffer(vma_allocator, frames[i].depth_bounds_buffer.buffer, frames[i].depth_bounds_buffer.allocation);
+		for (VkCommandPool pool : frames[i].worker_pools) {
+			vkDestroyCommandPool(device, pool, nullptr);
+		}
 	}
 	vkDestroyCommandPool(device, single_time_pool, nullptr);
 
 	
+	deletion_queue.flush_all();
 	destroy_swapchain();
 	vkDestroyImageView(device, shadowmap_image.view, nullptr);
-	vkDestroyImageView(device, draw_image.view, nullptr);
-	vkDestroyImageView(device, depth_image.view, nullptr);
 	vmaDestroyImage(vma_allocator, shadowmap_image.image, shadowmap_image.allocation);
-	vmaDestroyImage(vma_allocator, draw_image.image, draw_image.allocation);
-	vmaDestroyImage(vma_allocator, depth_image.image, depth_image.allocation);
+	vkDestroyImageView(device, shadow_cache_image.view, nullptr);
+	vmaDestroyImage(vma_allocator, shadow_cache_image.image, shadow_cache_image.allocation);
+	vkDestroyImageView(device, moments_image.view, nullptr);
+	vkDestroyImageView(device, moments_storage_view, nullptr);
+	vmaDestroyImage(vma_allocator, moments_image.image, moments_image.allocation);
+	vkDestroyImageView(device, moments_blur_image.view, nullptr);
+	vmaDestroyImage(vma_allocator, moments_blur_image.image, moments_blur_image.allocation);
+	vkDestroyImageView(device, atlas_image.view, nullptr);
+	vmaDestroyImage(vma_allocator, atlas_image.image, atlas_image.allocation);
+	vkDestroyImageView(device, point_image.view, nullptr);
+	vkDestroyImageView(device, point_cube_view, nullptr);
+	vmaDestroyImage(vma_allocator, point_image.image, point_image.allocation);
+	transient_pool.destroy(device, vma_allocator);
 
-	vmaDestroyBuffer(vma_allocator, ubo.buffer, ubo.allocation);
 
 	vkDestroySampler(device, shadowmap_sampler, nullptr);
+	vkDestroySampler(device, shadowmap_compare_sampler, nullptr);
+	vkDestroySampler(device, moments_sampler, nullptr);
+	vkDestroySampler(device, blit_sampler, nullptr);
 
 	vmaDestroyAllocator(vma_allocator);
 	vkDestroySurfaceKHR(instance, surface, nullptr);
@@ -68,21 +114,25 @@ void Engine::init() {
 	init_vulkan();
 	init_commands();
 
-	mesh_queue.push(model_res.bunny);
-	mesh_queue.push(model_res.teapot);
-	mesh_queue.push(model_res.square);
+	queue_mesh(model_res.bunny);
+	queue_mesh(model_res.teapot);
+	queue_mesh(model_res.square);
 	mesh_thread = std::thread(mesh_uploader, this);
 
 	init_swapchain();
 	init_draw_resources();
 	init_sync_structures();
+	init_queries();
 	init_ubo_data();
+	init_spot_lights(config.spot_lights);
+	init_point_lights(config.point_lights);
 	init_descriptors();
 	init_pipelines();
 }
 
 
 void Engine::run() {
+	window_start = std::chrono::high_resolution_clock::now();
 	while (!glfwWindowShouldClose(window)) {
 		auto start_time = std::chrono::high_resolution_clock::now();
 
@@ -94,11 +144,23 @@ void Engine::run() {
 		}
 
 		draw();
+		if (frame_counter % stats_interval == 0) {
+			report_stats();
+		}
 
 		auto stop_time = std::chrono::high_resolution_clock::now();;
 		std::ostringstream frame_time;
 		frame_time << std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time);;
-		std::string title = "Vulkan: " + frame_time.str();
+		std::string title = "Vulkan: " + frame_time.str()
+			+ " | draws: " + std::to_string(stats.draw_calls)
+			+ " | instances: " + std::to_string(stats.instances)
+			+ " | binds: " + std::to_string(stats.binds)
+			+ " | shadow views: " + std::to_string(stats.shadow_views) + " (" + std::to_string(stats.shadow_estimate_ms) + "ms)"
+			+ " | sort: " + std::to_string((int)stats.sort_time_us) + "us"
+			+ " | record: " + std::to_string((int)stats.record_time_us) + "us" + (parallel_recording ? " (parallel)" : "")
+			+ " | upload: " + std::to_string(stats.cpu_write_bytes) + "B"
+			+ " | scale: " + std::to_string((int)(stats.render_scale * 100.0f)) + "%"
+			+ " | pending delete: " + std::to_string(deletion_queue.pending_bytes / 1024) + "KB";
 		glfwSetWindowTitle(window, title.c_str());
 	}
 
@@ -106,15 +168,196 @@ void Engine::run() {
 }
 
 
+/*
+logs the last resolved GPU zone timings and fragment shader invocations
+*/
+void Engine::report_stats() {
+	std::string report = "GPU";
+	for (const GpuZoneResult& zone : profiler.results) {
+		report += " | " + zone.name + ": " + std::to_string(zone.ms) + "ms";
+		if (zone.has_statistics) {
+			report += " (" + std::to_string(zone.fragment_invocations) + " frags)";
+		}
+	}
+	report += " | barriers: " + std::to_string(stats.barriers);
+	report += std::string(" | depth prepass ") + (depth_prepass_enabled ? "on" : "off");
+	report += " | render targets: " + std::to_string(transient_pool.allocated_bytes / (1024 * 1024)) + "MB (peak "
+		+ std::to_string(transient_pool.peak_bytes / (1024 * 1024)) + "MB)";
+	LOG(1, report);
+
+	auto now = std::chrono::high_resolution_clock::now();
+	double window_s = std::chrono::duration<double>(now - window_start).count();
+	std::string pacing = std::string("Pacing | ") + string_VkPresentModeKHR(present_mode)
+		+ ", " + std::to_string(frames_in_flight) + " frames in flight, " + std::to_string(swapchain_images.size()) + " images";
+	if (latency_samples > 0) {
+		pacing += " | latency: " + std::to_string(latency_sum_ms / latency_samples) + "ms";
+	}
+	if (window_frames > 0 && window_s > 0.0) {
+		pacing += " | throughput: " + std::to_string(window_frames / window_s) + "fps";
+	}
+	LOG(1, pacing);
+
+	std::string cascade_report = "Cascades | " + std::to_string(cascades.count) + " x " + std::to_string(cascades.resolution) + "px"
+		+ std::string(" | blend ") + (mesh_shading.options.cascade_blend ? "on" : "off") + " | splits:";
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		cascade_report += " " + std::to_string(cascades.cascades[c].split_far);
+	}
+	cascade_report += " | texel:";
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		cascade_report += " " + std::to_string(cascades.cascades[c].texel_size);
+	}
+	cascade_report += " | casters:";
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		cascade_report += " " + std::to_string(cascades.casters[c]);
+	}
+	cascade_report += " (" + std::to_string(cascades.culled) + " culled)";
+	LOG(1, cascade_report);
+
+	static const char* shadow_mode_names[SHADOW_MODE_COUNT] = { "off", "hard", "pcf", "poisson", "pcss", "evsm" };
+	std::string filter_report = std::string("Shadow filter | ") + shadow_mode_names[mesh_shading.options.shadow_mode]
+		+ " | taps " + std::to_string(mesh_shading.options.filter_taps) + " | geo pass by mode:";
+	for (uint32_t m = 0; m < SHADOW_MODE_COUNT; m++) {
+		if (shadow_filter_samples[m] > 0) {
+			filter_report += std::string(" ") + shadow_mode_names[m] + " " + std::to_string(shadow_filter_ms[m] / shadow_filter_samples[m]) + "ms";
+		}
+	}
+	LOG(1, filter_report);
+
+	if (shadow_atlas.frames > 0) {
+		uint32_t shadowed = 0;
+		std::string resolutions;
+		for (const SpotLight& light : spot_lights) {
+			shadowed += light.tile.size != 0 ? 1 : 0;
+			resolutions += " " + std::to_string(light.tile.size);
+		}
+		LOG(1, "Shadow atlas | " + std::to_string(shadow_atlas.size) + "px | " + std::to_string(spot_lights_enabled ? spot_lights.size() : 0) + " lights, "
+			+ std::to_string(shadowed) + " shadowed | utilization " + std::to_string((int)(100.0f * shadow_atlas.utilization())) + "%"
+			+ " | tiles redrawn " + std::to_string(shadow_atlas.tile_redraws) + "/" + std::to_string(shadow_atlas.tile_frames)
+			+ " | resolution:" + resolutions);
+		shadow_atlas.reset_stats();
+	}
+
+	if (point_shadows.frames > 0) {
+		LOG(1, "Point shadows | " + std::to_string(point_lights.size()) + " lights, " + std::to_string(point_shadows.resolution) + "px faces"
+			+ " | faces redrawn " + std::to_string(point_shadows.face_redraws) + "/" + std::to_string(point_shadows.face_frames)
+			+ " | face draws " + std::to_string(point_shadows.casters) + " (" + std::to_string(point_shadows.culled) + " culled)");
+		point_shadows.reset_stats();
+	}
+
+	if (sample_distribution.readbacks > 0) {
+		LOG(1, "SDSM | cascades cover " + std::to_string(cascades.cascades[0].split_near)
+			+ " to " + std::to_string(cascades.cascades[cascades.count - 1].split_far) + " of " + std::to_string(camera.near_plane) + " to " + std::to_string(camera.far_plane)
+			+ " | average coverage " + std::to_string((int)(100.0 * sample_distribution.coverage_sum / sample_distribution.readbacks)) + "%"
+			+ " | refits " + std::to_string(sample_distribution.refits) + "/" + std::to_string(sample_distribution.readbacks) + " readbacks");
+		sample_distribution.reset_stats();
+	}
+
+	if (shadow_scheduler.frames > 0) {
+		float frame_count = (float)shadow_scheduler.frames;
+		std::string scheduler_report = std::string("Shadow scheduler | ") + (shadow_scheduler.enabled ? "on" : "off")
+			+ " | budget " + std::to_string(shadow_scheduler.budget_ms) + "ms"
+			+ " | views per frame: cascades " + std::to_string(shadow_scheduler.views_rendered[VIEW_CASCADE] / frame_count)
+			+ ", spots " + std::to_string(shadow_scheduler.views_rendered[VIEW_SPOT] / frame_count)
+			+ ", points " + std::to_string(shadow_scheduler.views_rendered[VIEW_POINT] / frame_count)
+			+ " | deferred " + std::to_string(shadow_scheduler.views_deferred / frame_count)
+			+ " | estimate " + std::to_string(shadow_scheduler.estimated_ms / frame_count) + "ms";
+		if (shadow_scheduler.measured_frames > 0) {
+			scheduler_report += ", measured " + std::to_string(shadow_scheduler.measured_ms / shadow_scheduler.measured_frames) + "ms";
+		}
+		scheduler_report += " (" + std::to_string(shadow_scheduler.ms_per_draw * 1000.0f) + "us per draw)"
+			+ " | over budget " + std::to_string(shadow_scheduler.over_budget_frames) + "/" + std::to_string(shadow_scheduler.frames) + " frames";
+		LOG(1, scheduler_report);
+		shadow_scheduler.reset_stats();
+	}
+
+	if (shadow_cache.frames > 0) {
+		uint32_t skipped_cascades = shadow_cache.cascade_frames - shadow_cache.cascade_redraws;
+		LOG(1, std::string("Shadow cache | ") + (shadow_cache.enabled ? "on" : "off")
+			+ " | pass skipped " + std::to_string(100 * shadow_cache.skipped_frames / shadow_cache.frames) + "% of frames"
+			+ " | static cascades redrawn " + std::to_string(shadow_cache.cascade_redraws) + "/" + std::to_string(shadow_cache.cascade_frames)
+			+ " (" + std::to_string(100 * skipped_cascades / std::max(shadow_cache.cascade_frames, 1u)) + "% skipped)"
+			+ " | dynamic frames " + std::to_string(shadow_cache.dynamic_frames));
+		shadow_cache.reset_stats();
+	}
+
+	LOG(1, "Pipelines | " + std::to_string(pipeline_registry.compiled_count()) + "/" + std::to_string(pipeline_registry.entries.size())
+		+ " compiled | hits: " + std::to_string(pipeline_registry.hits) + " | misses: " + std::to_string(pipeline_registry.misses)
+		+ " | fallbacks: " + std::to_string(pipeline_registry.fallbacks) + " | evicted: " + std::to_string(pipeline_registry.evicted));
+
+	if (descriptor_samples > 0) {
+		LOG(1, std::string("Descriptors | ") + (descriptor_buffer_enabled ? "descriptor buffer" : "descriptor sets")
+			+ " | update: " + std::to_string(descriptor_update_sum_us / descriptor_samples) + "us"
+			+ " | bind: " + std::to_string(descriptor_bind_sum_us / descriptor_samples) + "us for "
+			+ std::to_string(descriptor_bind_count / descriptor_samples) + " binds per frame");
+		descriptor_update_sum_us = 0.0;
+		descriptor_bind_sum_us = 0.0;
+		descriptor_bind_count = 0;
+		descriptor_samples = 0;
+	}
+
+	LOG(1, "Deletion queue | " + std::to_string(deletion_queue.pending.size()) + " pending, " + std::to_string(deletion_queue.pending_bytes / 1024)
+		+ "KB (peak " + std::to_string(deletion_queue.peak_pending_bytes / 1024) + "KB) | freed " + std::to_string(deletion_queue.destroyed_count)
+		+ " objects, " + std::to_string(deletion_queue.destroyed_bytes / 1024) + "KB");
+
+	if (resize_count > 0) {
+		LOG(1, "Resize | " + std::to_string(resize_count) + " hitched frames | avg " + std::to_string(resize_hitch_sum_ms / resize_count)
+			+ "ms | worst " + std::to_string(resize_hitch_max_ms) + "ms");
+		resize_count = 0;
+		resize_hitch_sum_ms = 0.0;
+		resize_hitch_max_ms = 0.0;
+	}
+
+	//last measured cost of each present path, cycle with B to fill in all three
+	//the blit & the compute copy do the same work, the tonemap adds ACES on top
+	const GpuZoneResult* blit_zone = profiler.find("blit");
+	const GpuZoneResult* copy_zone = profiler.find("compute_copy");
+	const GpuZoneResult* tonemap_zone = profiler.find("tonemap");
+	blit_ms = blit_zone != nullptr ? blit_zone->ms : blit_ms;
+	copy_ms = copy_zone != nullptr ? copy_zone->ms : copy_ms;
+	tonemap_ms = tonemap_zone != nullptr ? tonemap_zone->ms : tonemap_ms;
+	std::string present_report = "Present pass | " + std::to_string(swapchain_extent.width) + "x" + std::to_string(swapchain_extent.height)
+		+ " | blit: " + std::to_string(blit_ms) + "ms";
+	if (compute_present_supported) {
+		present_report += " | compute copy: " + std::to_string(copy_ms) + "ms | compute tonemap: " + std::to_string(tonemap_ms) + "ms";
+	}
+	else {
+		present_report += " | compute: unsupported";
+	}
+	LOG(1, present_report);
+
+	float ms_lo, ms_avg, ms_hi, scale_lo, scale_avg, scale_hi;
+	resolution_scaler.summary(resolution_scaler.frame_ms, ms_lo, ms_avg, ms_hi);
+	resolution_scaler.summary(resolution_scaler.scales, scale_lo, scale_avg, scale_hi);
+	LOG(1, std::string("Resolution ") + (resolution_scaler.enabled ? "dynamic" : "fixed")
+		+ " | " + std::to_string(draw_extent.width) + "x" + std::to_string(draw_extent.height)
+		+ " | scale " + std::to_string(scale_lo) + "/" + std::to_string(scale_avg) + "/" + std::to_string(scale_hi)
+		+ " | gpu frame " + std::to_string(ms_lo) + "/" + std::to_string(ms_avg) + "/" + std::to_string(ms_hi)
+		+ "ms (min/avg/max) | target " + std::to_string(resolution_scaler.target_ms) + "ms");
+	latency_sum_ms = 0.0;
+	latency_samples = 0;
+	window_frames = 0;
+	window_start = now;
+}
+
+
 static void mesh_uploader(Engine* engine) {
 	while (true) {
+		std::unique_lock<std::mutex> lock(engine->mesh_queue_mutex);
 		if (engine->mesh_queue.empty()) {
+			lock.unlock();
 			std::this_thread::sleep_for(std::chrono::milliseconds(100));
 			continue;
 		}
 		
 		MeshResource res = engine->mesh_queue.front();
 		engine->mesh_queue.pop();
+		//queued instances of the same mesh are added as one batch, one scene change instead of one per instance
+		std::vector<glm::mat4> models = { res.model_mat };
+		while (!engine->mesh_queue.empty() && engine->mesh_queue.front().file_path == res.file_path && engine->mesh_queue.front().type == res.type) {
+			models.push_back(engine->mesh_queue.front().model_mat);
+			engine->mesh_queue.pop();
+		}
+		lock.unlock();
 		if (res.file_path == "QUIT") {
 			break;
 		}
@@ -122,10 +365,10 @@ static void mesh_uploader(Engine* engine) {
 		switch (res.type)
 		{
 		case MESHTYPE::OBJ:
-			engine->load_obj(res.file_path, res.model_mat);
+			engine->load_obj(res.file_path, models);
 			break;
 		case MESHTYPE::GLTF:
-			engine->load_gltf(res.file_path, res.model_mat);
+			engine->load_gltf(res.file_path, models);
 			break;
 		default:
 			break;
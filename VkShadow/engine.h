@@ -2,10 +2,18 @@
 #include <stdexcept>
 #include <span>
 #include <queue>
+#include <algorithm>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <condition_variable>
 #include <unordered_map>
 #include <fstream>
+#include <filesystem>
+#include <sstream>
 #include <thread>
 #include <chrono>
+#include <bit>
 #include <glm/gtx/transform.hpp>
 
 #include "vk_mem_alloc.h"
@@ -19,19 +27,43 @@
 #include "logger.h"
 #include "common.h"
 #include "builders.h"
-
-#define FRAMES_IN_FLIGHT 2
+#include "draw_list.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "render_graph.h"
+#include "deletion_queue.h"
+#include "pipeline_cache.h"
+#include "shader_variant.h"
+#include "pipeline_registry.h"
+#include "transient_pool.h"
+#include "frame_ring.h"
+#include "descriptor_buffer.h"
+#include "resolution_scaler.h"
+#include "cascades.h"
+#include "shadow_cache.h"
+#include "shadow_atlas.h"
+#include "point_shadows.h"
+#include "sample_distribution.h"
+#include "shadow_scheduler.h"
 
 
 class Engine {
 public:
 	Engine();
-	Engine(int w, int h);
+	Engine(int w, int h, EngineConfig engine_config = {});
 	~Engine();
 	bool framebuffer_resized = false;
 	bool use_validation_layers = false;
 	bool use_debug_messenger = false;
 	bool minimized = false;
+	bool parallel_recording = false;
+	bool depth_prepass_enabled = false;
+	bool depth_prepass_active = false;		//enabled and its pipelines have finished compiling
+	bool depth_reduce_active = false;		//SDSM on and its pipeline has finished compiling, depth_image is kept for it
+	bool two_sided = false;					//debug view, geometry pipelines without back face culling
+	bool animating = false;					//spins the bunny's instances, making them dynamic shadow casters
+	bool spot_lights_enabled = true;
+	bool dump_graph_requested = false;
 	void run();
 
 
@@ -41,8 +73,14 @@ public:
 	//Utility - Mesh Loading
 	std::thread mesh_thread;
 	std::queue<MeshResource> mesh_queue;
-	void load_obj(std::string file_name, glm::mat4 model);
-	void load_gltf(std::string file_name, glm::mat4 model);
+	std::mutex mesh_queue_mutex;
+	void queue_mesh(const MeshResource& res);
+	void spawn_instance_grid(const MeshResource& res, uint32_t count);
+	void load_obj(std::string file_name, std::span<const glm::mat4> models);
+	void load_gltf(std::string file_name, std::span<const glm::mat4> models);
+	void unload_mesh(const std::string& file_name);
+	void set_mesh_dynamic(const std::string& file_name, bool dynamic);
+	void animate_instances();
 
 	//---------------------------------//
 	//Callback Handlers
@@ -73,6 +111,12 @@ private:
 	uint32_t graphics_queue_family;
 	uint32_t transfer_queue_family;
 
+	float timestamp_period;
+	bool pipeline_statistics_supported = false;
+	bool anisotropy_supported = false;
+	float max_anisotropy = 1.0f;
+	bool descriptor_buffer_enabled = false;		//VK_EXT_descriptor_buffer present & requested
+
 	VkCommandPool single_time_pool;
 	VkFence single_time_fence;
 	
@@ -87,34 +131,166 @@ private:
 	bool resize_requested = false;
 	uint32_t frame_number = 0;
 	uint32_t frame_counter = 0;
+
+	//Frame pacing
+	EngineConfig config;
+	uint32_t frames_in_flight = 2;
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	double latency_sum_ms = 0.0;
+	uint32_t latency_samples = 0;
+	uint32_t window_frames = 0;
+	std::chrono::high_resolution_clock::time_point window_start;
+
+	//Deferred deletion - anything frames in flight may still use waits here until their fences signal
+	DeletionQueue deletion_queue;
+
+	//Resize
+	bool resize_hitch_pending = false;
+	uint32_t resize_count = 0;
+	double resize_hitch_sum_ms = 0.0;
+	double resize_hitch_max_ms = 0.0;
 	
 	//Rendering Data
+	ThreadPool workers;
+	uint32_t worker_count = 0;
+	ThreadPool compile_workers;		//pipeline compiles, kept off workers so recording never queues behind them
 	std::vector<PerFrameData> frames;
 	ImageData draw_image;
 	ImageData shadowmap_image;
+	ImageData shadow_cache_image;		//static caster depth, copied under the dynamic casters each frame
+	ImageData moments_image;			//EVSM moments per cascade with a full mip chain
+	ImageData moments_blur_image;		//horizontally blurred moments, mip 0 only
+	VkImageView moments_storage_view;	//mip 0 of moments_image, written by the vertical blur
+	uint32_t moments_mips;
+	bool moments_valid = false;			//moments_image matches shadowmap_image
+	ImageData atlas_image;				//spot light depth, a tile per shadowed light
+	ImageData point_image;				//point light distance, 6 layers per light, view is a 2D array for rendering
+	VkImageView point_cube_view;		//the same layers as a cube array for sampling
 	ImageData depth_image;
 
-	VkExtent2D draw_extent;
+	VkExtent2D draw_extent;		//scaled sub rectangle of draw_image that is rendered & blitted
+	ResolutionScaler resolution_scaler;
+	uint64_t scaler_sample = 0;
+
+	//geo pass GPU time per shadow filter, running averages of the variants actually drawn
+	uint32_t shaded_shadow_mode = SHADOW_MODE_COUNT;
+	double shadow_filter_ms[SHADOW_MODE_COUNT] = {};
+	uint32_t shadow_filter_samples[SHADOW_MODE_COUNT] = {};
+	uint64_t shadow_filter_sample = 0;
+
+	RenderGraph render_graph;
+	uint32_t rg_draw;
+	uint32_t rg_depth;
+	uint32_t rg_shadowmap;
+	uint32_t rg_shadow_cache;
+	uint32_t rg_moments;
+	uint32_t rg_moments_blur;
+	uint32_t rg_atlas;
+	uint32_t rg_point;
+	uint32_t rg_swapchain;
+	std::string graph_signature;
+	TransientPool transient_pool;
+
 	VkSampler shadowmap_sampler;
+	VkSampler shadowmap_compare_sampler;		//hardware depth compare, reversed Z so lit is GREATER_OR_EQUAL
+	VkSampler moments_sampler;					//trilinear, anisotropic where supported
+	VkSampler blit_sampler;
+
+	//Present - tonemap compute straight into the swapchain when it allows storage, blit otherwise
+	bool compute_present_supported = false;
+	bool compute_present_enabled = true;
+	bool present_tonemap = true;		//ACES in the compute pass, off it copies like the blit so the two time like for like
+	VkPipelineStageFlags2 swapchain_wait_stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	float blit_ms = 0.0f;
+	float copy_ms = 0.0f;
+	float tonemap_ms = 0.0f;
 	
-	UniformBufferObject ubo_data;
-	BufferData ubo;
+	UniformBufferObject ubo_data;		//CPU copy, dirty fields are copied into each frame's ring slice
 
-	Light sun;
+	//Per frame uploads - uniforms at the start of each slice, instance transforms after
+	FrameRing frame_ring;
+	VkDeviceSize uniform_alignment = 256;
+	VkDeviceSize ring_instance_offset = 0;
+	uint64_t camera_version = 1;
+	uint64_t light_version = 1;
+	uint64_t material_version = 1;
+	uint64_t spot_light_version = 1;
+	uint64_t point_light_version = 1;
+	Camera camera;
+	std::chrono::high_resolution_clock::time_point last_camera_update;
+
+	Light sun;		//directional, sun.pos only gives the direction toward it
+	CascadedShadows cascades;		//one layer of shadowmap_image each, refit whenever the camera moves
+	uint64_t cascade_camera_version = 0;
+	ShadowCache shadow_cache;
+	std::vector<SpotLight> spot_lights;		//tiles reassigned whenever the camera moves
+	ShadowAtlas shadow_atlas;
+	uint64_t spot_camera_version = 0;
+	std::vector<PointLight> point_lights;
+	PointShadows point_shadows;
+	SampleDistribution sample_distribution;		//cascade range fit to the visible depth, see sample_distribution.h
+	ShadowScheduler shadow_scheduler;			//which pending cascades & lights are redrawn each frame
+	uint64_t shadow_cost_sample = 0;
+
+	//Scene - guarded by scene_mutex, written by the mesh uploader
+	std::mutex scene_mutex;
+	uint64_t scene_version = 0;
+	uint64_t static_scene_version = 0;		//only bumped by changes to static casters, not by animation
+	uint64_t batch_static_version = 0;		//static_scene_version draw_batches was built from
+	std::chrono::high_resolution_clock::time_point last_animation_update;
+	std::unordered_map<std::string, uint32_t> mesh_ids;
 	std::vector<MeshData> meshes;
-	//std::vector<Light> lights;
+	std::vector<MeshInstance> instances;
+	std::vector<DrawBatch> draw_batches;
+	DrawList draw_list;
+
+	FrameStats stats = {};
+	GpuProfiler profiler;
+	uint32_t stats_interval = 120;	//frames between GPU timing reports
 
 	//Descriptors
 	DescriptorBuilder descriptor_builder;
 	VkDescriptorSetLayout global_layout;
-	VkDescriptorSet global_set;
+	VkDescriptorSet global_set = VK_NULL_HANDLE;		//classic path only
+	std::vector<VkDescriptorSet> spare_global_sets;	//replaced by frame_ring growth, reusable once retired
+	DescriptorBuffer descriptor_buffer;				//descriptor buffer path, a copy of the global set per frame in flight
+	uint64_t descriptor_version = 1;
+	double descriptor_update_sum_us = 0.0;
+	double descriptor_bind_sum_us = 0.0;
+	uint64_t descriptor_bind_count = 0;
+	uint32_t descriptor_samples = 0;
+	VkDescriptorSetLayout tonemap_set_layout;
+	std::vector<VkDescriptorSet> tonemap_sets;		//one per frame in flight, rewritten each frame
+	VkDescriptorSetLayout moments_set_layout;
+	VkDescriptorSet moments_sets[2];				//horizontal & vertical blur, their images never change
+	VkDescriptorSetLayout depth_reduce_set_layout;
+	std::vector<VkDescriptorSet> depth_reduce_sets;	//one per frame in flight, depth_image is transient so rewritten each frame
 
 	//Pipelines
-	PipelineBuilder pipeline_builder;
-	VkPipeline mesh_pipeline;
+	PipelineRegistry pipeline_registry;
+	PipelineDesc mesh_desc;
+	PipelineDesc mesh_equal_desc;
+	PipelineDesc shadow_desc;
+	PipelineDesc point_shadow_desc;
+	PipelineDesc depth_prepass_desc;
+	PipelineDesc tonemap_desc;
+	PipelineDesc moments_desc;
+	PipelineDesc depth_reduce_desc;
+	ShaderVariant<MeshShadingOptions> mesh_shading;		//shadow & lighting path of mesh.frag, see common.h
 	VkPipelineLayout mesh_pipeline_layout;
-	VkPipeline shadow_pipeline;
 	VkPipelineLayout shadow_pipeline_layout;
+	VkPipeline tonemap_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout tonemap_pipeline_layout;
+	VkPipeline moments_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout moments_pipeline_layout;
+	VkPipeline depth_reduce_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout depth_reduce_pipeline_layout;
+	std::vector<PipelineBinding> pipeline_table;
+	uint64_t pipeline_state = 0;			//variant & cull state pipeline_table was resolved for
+	bool pipelines_stale = true;			//resolve again, the state changed or a compile finished
+	uint32_t pipeline_evict_frames = 600;	//frames a variant stays unbound before its pipeline is destroyed
+	PipelineCache pipeline_cache;			//loaded in init_vulkan, saved on shutdown
+	double pipeline_create_ms = 0.0;
 
 
 	//---------------------------------//
@@ -126,20 +302,59 @@ private:
 	void init_draw_resources();
 	void init_commands();			//command pools & bufferse
 	void init_sync_structures();
+	void init_queries();
 	
 	void init_descriptors();
 	void init_ubo_data();
+	void init_spot_lights(uint32_t count);
+	void init_point_lights(uint32_t count);
 
 	void init_pipelines();
 	void init_mesh_pipeline();
 	void init_shadow_pipeline();
+	void init_depth_prepass_pipeline();
+	void init_tonemap_pipeline();
+	void init_moments_pipeline();
+	void init_depth_reduce_pipeline();
+	PipelineEntry& request_pipeline(const PipelineDesc& desc);
+	VkPipeline get_pipeline(const PipelineDesc& desc, VkPipeline fallback);
+	VkPipeline compile_pipeline(const PipelineDesc& desc);
+	void poll_pipelines();
+	void update_pipelines();
+	void evict_pipelines();
 
 
 	//---------------------------------//
 	//Drawing
 	void draw();
+	void build_render_graph(uint32_t swapchain_index);
+	void update_render_targets();
+	void write_tonemap_set(uint32_t swapchain_index);
+	void tonemap(VkCommandBuffer cmd, uint32_t swapchain_index);
 	void draw_geo(VkCommandBuffer cmd);
-	void draw_shadowmaps(VkCommandBuffer cmd);
+	void draw_shadowmaps(VkCommandBuffer cmd, const ImageData& target, uint32_t layer_count, std::span<const DrawCommand> draws, const std::vector<VkCommandBuffer>& secondaries, bool clear_all, std::span<const VkClearRect> clears);
+	std::vector<VkClearRect> cascade_clear_rects(uint32_t clear_mask);
+	std::vector<VkClearRect> atlas_clear_rects();
+	std::vector<VkClearRect> point_clear_rects();
+	void clear_depth_rects(VkCommandBuffer cmd, std::span<const VkClearRect> rects);
+	void copy_shadow_cache(VkCommandBuffer cmd);
+	void blur_moments(VkCommandBuffer cmd, uint32_t axis);
+	void generate_moment_mips(VkCommandBuffer cmd);
+	void write_depth_reduce_set();
+	void reduce_depth(VkCommandBuffer cmd);
+	void read_depth_bounds();
+	void draw_depth_prepass(VkCommandBuffer cmd);
+	void report_stats();
+	void sample_frame_latency();
+	void sample_shadow_filter_cost();
+	void sample_shadow_cost();
+	void update_render_scale();
+	void record_resize_hitch(std::chrono::high_resolution_clock::time_point cpu_start);
+	void build_draw_list();
+	void record_draws(VkCommandBuffer cmd, std::span<const DrawCommand> draws, BindState& state);
+	void record_secondaries();
+	void record_secondary(VkCommandBuffer cmd, const VkCommandBufferInheritanceRenderingInfo& rendering, VkExtent2D extent, std::span<const DrawCommand> draws, BindState& state, std::span<const VkClearRect> clears = {});
+	void set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent, VkOffset2D offset = { 0, 0 });
 
 	//---------------------------------//
 	//Utility
@@ -153,9 +368,19 @@ private:
 	void copy_image(VkCommandBuffer cmd, VkImage src_image, VkImage dst_image, VkExtent2D src_extent, VkExtent2D dst_extent);
 	
 	void update_uniform_buffer();
+	void update_instance_buffer();
+	void update_camera();
+	void update_cascades();
+	void update_spot_lights();
+	void schedule_shadows();
+	void grow_frame_ring(size_t instance_bytes);
+	void write_global_set(VkDescriptorSet set);
+	void write_descriptor_buffer(uint32_t frame);
+	void update_global_descriptors();
+	void flush_deletions();
 	//---------------------------------//
 	//Swapchain management
-	void create_swapchain(uint32_t width, uint32_t height);
+	void create_swapchain(uint32_t width, uint32_t height, VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
 	void resize_swapchain();
 	void destroy_swapchain();
 
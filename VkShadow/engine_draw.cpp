@@ -1,19 +1,46 @@
 #include "engine.h"
 
 void Engine::draw() {
+	auto cpu_start = std::chrono::high_resolution_clock::now();
+	sample_frame_latency();
 	VK_CHECK(vkWaitForFences(device, 1, &frames.at(frame_number).render_fence, VK_TRUE, 1000000000));
+	sample_frame_latency();
+	read_depth_bounds();
+	flush_deletions();
+	poll_pipelines();
+	update_pipelines();
+	evict_pipelines();
+	depth_prepass_active = depth_prepass_enabled && pipeline_table[DEPTH_PREPASS_PIPELINE_ID].pipeline != VK_NULL_HANDLE
+		&& pipeline_table[MESH_EQUAL_PIPELINE_ID].pipeline != VK_NULL_HANDLE;
+	depth_reduce_active = sample_distribution.enabled && depth_reduce_pipeline != VK_NULL_HANDLE;
 
 	uint32_t swapchain_index;
 	VkResult acquire_res = vkAcquireNextImageKHR(device, swapchain, 1000000000, frames.at(frame_number).swapcahin_semaphore, nullptr, &swapchain_index);
 	if (acquire_res == VK_ERROR_OUT_OF_DATE_KHR) {
 		resize_swapchain();
+		record_resize_hitch(cpu_start);
 		return;
 	}
 	else if (acquire_res != VK_SUCCESS && acquire_res != VK_SUBOPTIMAL_KHR) {
 		throw std::runtime_error("failed to acqurie swapchain image!");
 	}
 
+	stats.cpu_write_bytes = 0;
+	update_render_scale();
+	animate_instances();
+	update_instance_buffer();
 	update_uniform_buffer();
+	update_global_descriptors();
+	build_draw_list();
+	stats.draw_calls = 0;
+	stats.binds = 0;
+	stats.descriptor_binds = 0;
+	stats.descriptor_bind_us = 0.0f;
+
+	auto record_start = std::chrono::high_resolution_clock::now();
+	if (parallel_recording) {
+		record_secondaries();
+	}
 
 	VK_CHECK(vkResetFences(device, 1, &frames.at(frame_number).render_fence));
 	VkCommandBuffer cmd = frames.at(frame_number).command_buffer;
@@ -26,47 +53,22 @@ void Engine::draw() {
 	cmd_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+	profiler.begin_frame(device, cmd, frame_number);
+	sample_shadow_filter_cost();
+	sample_shadow_cost();
 
-	//uber barriers for debug
-	TransitionData td = {};
-	td.barrier_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
-	td.src_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-	td.dst_layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-
-	td.src_mask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-	td.dst_mask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-	td.src_acc = VK_ACCESS_2_MEMORY_WRITE_BIT;
-	td.dst_acc = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
-
-	transition_image(cmd, shadowmap_image.image, td);
-	draw_shadowmaps(cmd);
-	
-	
-	transition_image(cmd, depth_image.image, td);
-	td.src_layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-	td.dst_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	transition_image(cmd, shadowmap_image.image, td);
-	td.barrier_aspect = VK_IMAGE_ASPECT_COLOR_BIT;
-	td.src_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-	td.dst_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	transition_image(cmd, draw_image.image, td);
-
-	draw_geo(cmd);
-
-	td.src_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	td.dst_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-	transition_image(cmd, draw_image.image, td);
-	td.src_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-	td.dst_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	transition_image(cmd, swapchain_images.at(swapchain_index), td);
-	
-	copy_image(cmd, draw_image.image, swapchain_images.at(swapchain_index), draw_extent, swapchain_extent);
-
-	td.src_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	td.dst_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-	transition_image(cmd, swapchain_images.at(swapchain_index), td);
+	uint32_t frame_zone = profiler.begin_zone(cmd, frame_number, "frame");
+	build_render_graph(swapchain_index);
+	stats.barriers = render_graph.execute(cmd);
+	profiler.end_zone(cmd, frame_number, frame_zone);
 
 	VK_CHECK(vkEndCommandBuffer(cmd));
+	auto record_stop = std::chrono::high_resolution_clock::now();
+	stats.record_time_us = std::chrono::duration<float, std::micro>(record_stop - record_start).count();
+	descriptor_update_sum_us += stats.descriptor_update_us;
+	descriptor_bind_sum_us += stats.descriptor_bind_us;
+	descriptor_bind_count += stats.descriptor_binds;
+	descriptor_samples++;
 
 	VkCommandBufferSubmitInfo cmd_submit_info = {};
 	cmd_submit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
@@ -78,7 +80,7 @@ void Engine::draw() {
 	wait_semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
 	wait_semaphore_info.pNext = nullptr;
 	wait_semaphore_info.semaphore = frames.at(frame_number).swapcahin_semaphore;
-	wait_semaphore_info.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+	wait_semaphore_info.stageMask = swapchain_wait_stage;
 	wait_semaphore_info.deviceIndex = 0;
 	wait_semaphore_info.value = 1;
 
@@ -86,7 +88,7 @@ void Engine::draw() {
 	signal_semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
 	signal_semaphore_info.pNext = nullptr;
 	signal_semaphore_info.semaphore = frames.at(frame_number).render_semaphore;
-	signal_semaphore_info.stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
+	signal_semaphore_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
 	signal_semaphore_info.deviceIndex = 0;
 	signal_semaphore_info.value = 1;
 
@@ -112,18 +114,395 @@ void Engine::draw() {
 	present_info.pImageIndices = &swapchain_index;
 
 	VkResult present_res = vkQueuePresentKHR(graphics_queue, &present_info);
-	if (present_res == VK_ERROR_OUT_OF_DATE_KHR || present_res == VK_SUBOPTIMAL_KHR || resize_requested) {
+	if (present_res == VK_ERROR_OUT_OF_DATE_KHR || present_res == VK_SUBOPTIMAL_KHR || resize_requested || framebuffer_resized) {
 		resize_requested = false;
+		framebuffer_resized = false;
 		resize_swapchain();
 	}
 	else if (present_res != VK_SUCCESS) {
 		logger.err("Failed to present to swapchain");
 	};
 
-	frame_number = (frame_number + 1) % FRAMES_IN_FLIGHT;
+	frames.at(frame_number).cpu_start = cpu_start;
+	frames.at(frame_number).awaiting_completion = true;
+	window_frames++;
+
+	record_resize_hitch(cpu_start);
+
+	frame_number = (frame_number + 1) % frames_in_flight;
 	frame_counter++;
 }
 
+/*
+CPU time of a frame that recreated the swapchain or reallocated render targets
+*/
+void Engine::record_resize_hitch(std::chrono::high_resolution_clock::time_point cpu_start) {
+	if (!resize_hitch_pending) {
+		return;
+	}
+	resize_hitch_pending = false;
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cpu_start).count();
+	resize_count++;
+	resize_hitch_sum_ms += ms;
+	resize_hitch_max_ms = std::max(resize_hitch_max_ms, ms);
+}
+
+/*
+feeds each newly resolved GPU frame time to the scaler and picks this frame's draw_extent
+draw_image stays allocated at full size, only the rendered & blitted rectangle changes
+*/
+void Engine::update_render_scale() {
+	const GpuZoneResult* frame_zone = profiler.find("frame");
+	if (frame_zone != nullptr && profiler.resolved_count != scaler_sample) {
+		scaler_sample = profiler.resolved_count;
+		stats.gpu_frame_ms = frame_zone->ms;
+		resolution_scaler.update(frame_zone->ms);
+	}
+	else if (!resolution_scaler.enabled) {
+		resolution_scaler.scale = resolution_scaler.max_scale;
+	}
+
+	VkExtent2D max_extent = { draw_image.extent.width, draw_image.extent.height };
+	draw_extent = resolution_scaler.extent(max_extent);
+	stats.render_scale = resolution_scaler.scale;
+}
+
+/*
+charges the geo pass time just resolved to the shadow mode its frame was drawn with
+the results are this frame slot's previous use, so its mode is read before being replaced
+*/
+void Engine::sample_shadow_filter_cost() {
+	PerFrameData& frame = frames.at(frame_number);
+	const GpuZoneResult* geo_zone = profiler.find("geo");
+	if (geo_zone != nullptr && profiler.resolved_count != shadow_filter_sample && frame.shaded_shadow_mode < SHADOW_MODE_COUNT) {
+		shadow_filter_ms[frame.shaded_shadow_mode] += geo_zone->ms;
+		shadow_filter_samples[frame.shaded_shadow_mode]++;
+	}
+	shadow_filter_sample = profiler.resolved_count;
+	frame.shaded_shadow_mode = shaded_shadow_mode;
+}
+
+/*
+charges the shadow pass time just resolved to the shadow draws its frame recorded, the scheduler's cost per draw
+like sample_shadow_filter_cost the results are this frame slot's previous use
+*/
+void Engine::sample_shadow_cost() {
+	PerFrameData& frame = frames.at(frame_number);
+	if (profiler.resolved_count != shadow_cost_sample) {
+		float shadow_ms = 0.0f;
+		for (const char* name : { "shadow", "shadow_static", "shadow_dynamic", "shadow_atlas", "shadow_point" }) {
+			const GpuZoneResult* zone = profiler.find(name);
+			shadow_ms += zone != nullptr ? zone->ms : 0.0f;
+		}
+		shadow_scheduler.sample(shadow_ms, frame.shadow_draws);
+	}
+	shadow_cost_sample = profiler.resolved_count;
+	frame.shadow_draws = (uint32_t)draw_list.pass_range(SHADOW_PASS, POINT_SHADOW_PASS).size();
+}
+
+/*
+polls the fences of submitted frames, granularity is one frame so the latency is an upper bound
+a frame counts from the start of its draw(), including any wait for a free frame slot
+*/
+void Engine::sample_frame_latency() {
+	auto now = std::chrono::high_resolution_clock::now();
+	for (PerFrameData& frame : frames) {
+		if (!frame.awaiting_completion || vkGetFenceStatus(device, frame.render_fence) != VK_SUCCESS) {
+			continue;
+		}
+		frame.awaiting_completion = false;
+		latency_sum_ms += std::chrono::duration<double, std::milli>(now - frame.cpu_start).count();
+		latency_samples++;
+	}
+}
+
+/*
+declares this frame's passes and the images each one touches
+the graph derives layouts & barriers and culls passes that don't reach present
+*/
+void Engine::build_render_graph(uint32_t swapchain_index) {
+	//the acquire semaphore is waited on at the stage that first touches the swapchain, the first barrier chains onto it
+	bool compute_present = compute_present_supported && compute_present_enabled;
+	swapchain_wait_stage = compute_present ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	RGImageState acquired = { VK_IMAGE_LAYOUT_UNDEFINED, swapchain_wait_stage, VK_ACCESS_2_NONE };
+
+	render_graph.reset();
+	render_graph.set_image(rg_swapchain, swapchain_images.at(swapchain_index), acquired);
+
+	//with nothing dirty & no dynamic casters the shadow map is left as the last frame drew it
+	uint32_t all_cascades = (1u << cascades.count) - 1;
+	if (shadow_cache.has_dynamic) {
+		if (shadow_cache.dirty_mask != 0) {
+			uint32_t static_pass = render_graph.add_pass("shadow_static", [this](VkCommandBuffer cmd) {
+				uint32_t zone = profiler.begin_zone(cmd, frame_number, "shadow_static");
+				draw_shadowmaps(cmd, shadow_cache_image, cascades.count, draw_list.pass_range(SHADOW_PASS), frames.at(frame_number).worker_shadow_cmds,
+					shadow_cache.dirty_mask == (1u << cascades.count) - 1, cascade_clear_rects(shadow_cache.dirty_mask));
+				profiler.end_zone(cmd, frame_number, zone);
+			});
+			render_graph.write(static_pass, rg_shadow_cache, RG_DEPTH_ATTACHMENT, shadow_cache.dirty_mask == all_cascades);
+		}
+
+		uint32_t copy_pass = render_graph.add_pass("shadow_copy", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "shadow_copy");
+			copy_shadow_cache(cmd);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.read(copy_pass, rg_shadow_cache, RG_TRANSFER_SRC);
+		render_graph.write(copy_pass, rg_shadowmap, RG_TRANSFER_DST, true);
+
+		uint32_t dynamic_pass = render_graph.add_pass("shadow_dynamic", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "shadow_dynamic");
+			draw_shadowmaps(cmd, shadowmap_image, cascades.count, draw_list.pass_range(SHADOW_DYNAMIC_PASS), frames.at(frame_number).worker_shadow_dynamic_cmds, false, {});
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.write(dynamic_pass, rg_shadowmap, RG_DEPTH_ATTACHMENT);
+	}
+	else if (shadow_cache.dirty_mask != 0) {
+		uint32_t shadow_pass = render_graph.add_pass("shadow", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "shadow");
+			draw_shadowmaps(cmd, shadowmap_image, cascades.count, draw_list.pass_range(SHADOW_PASS, SHADOW_DYNAMIC_PASS), frames.at(frame_number).worker_shadow_cmds,
+				shadow_cache.dirty_mask == (1u << cascades.count) - 1, cascade_clear_rects(shadow_cache.dirty_mask));
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.write(shadow_pass, rg_shadowmap, RG_DEPTH_ATTACHMENT, shadow_cache.dirty_mask == all_cascades);
+	}
+
+	//every spot light tile redrawn this frame in one pass, the rest of the atlas is loaded as it was
+	if (shadow_atlas.any_dirty(spot_lights)) {
+		uint32_t atlas_pass = render_graph.add_pass("shadow_atlas", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "shadow_atlas");
+			draw_shadowmaps(cmd, atlas_image, 1, draw_list.pass_range(SPOT_SHADOW_PASS), frames.at(frame_number).worker_atlas_cmds, false, atlas_clear_rects());
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.write(atlas_pass, rg_atlas, RG_DEPTH_ATTACHMENT);
+	}
+
+	//every dirty face of every point light in one layered pass, the whole image is cleared when every face is dirty
+	if (point_shadows.any_dirty(point_lights)) {
+		bool all_faces = std::all_of(point_lights.begin(), point_lights.end(), [](const PointLight& light) { return light.dirty_mask == 0x3F; });
+		uint32_t point_pass = render_graph.add_pass("shadow_point", [this, all_faces](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "shadow_point");
+			draw_shadowmaps(cmd, point_image, 6 * (uint32_t)point_lights.size(), draw_list.pass_range(POINT_SHADOW_PASS), frames.at(frame_number).worker_point_cmds,
+				all_faces, point_clear_rects());
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.write(point_pass, rg_point, RG_DEPTH_ATTACHMENT, all_faces);
+	}
+
+	//EVSM moments are rebuilt whenever the shadow map changed under them, filtered once per texel here
+	bool shadow_drawn = shadow_cache.has_dynamic || shadow_cache.dirty_mask != 0;
+	bool evsm = mesh_shading.options.shadow_mode == SHADOW_EVSM && moments_pipeline != VK_NULL_HANDLE;
+	if (evsm && (shadow_drawn || !moments_valid)) {
+		uint32_t blur_x = render_graph.add_pass("moments_blur_x", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "moments_blur_x");
+			blur_moments(cmd, 0);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.read(blur_x, rg_shadowmap, RG_SAMPLED_COMPUTE);
+		render_graph.write(blur_x, rg_moments_blur, RG_STORAGE_COMPUTE, true);
+
+		uint32_t blur_y = render_graph.add_pass("moments_blur_y", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "moments_blur_y");
+			blur_moments(cmd, 1);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.read(blur_y, rg_moments_blur, RG_SAMPLED_COMPUTE);
+		render_graph.write(blur_y, rg_moments, RG_STORAGE_COMPUTE, true);
+
+		uint32_t mips = render_graph.add_pass("moments_mips", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "moments_mips");
+			generate_moment_mips(cmd);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.write(mips, rg_moments, RG_TRANSFER_DST);
+		moments_valid = true;
+	}
+	else if (shadow_drawn) {
+		moments_valid = false;
+	}
+
+	if (depth_prepass_active) {
+		uint32_t prepass = render_graph.add_pass("depth_prepass", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "prepass", true);
+			draw_depth_prepass(cmd);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.write(prepass, rg_depth, RG_DEPTH_ATTACHMENT, true);
+	}
+
+	uint32_t geo_pass = render_graph.add_pass("geo", [this](VkCommandBuffer cmd) {
+		uint32_t zone = profiler.begin_zone(cmd, frame_number, "geo", true);
+		draw_geo(cmd);
+		profiler.end_zone(cmd, frame_number, zone);
+	});
+	render_graph.read(geo_pass, rg_shadowmap, RG_SAMPLED_FRAGMENT);
+	render_graph.read(geo_pass, rg_moments, RG_SAMPLED_FRAGMENT);
+	render_graph.read(geo_pass, rg_atlas, RG_SAMPLED_FRAGMENT);
+	render_graph.read(geo_pass, rg_point, RG_SAMPLED_FRAGMENT);
+	if (depth_prepass_active) {
+		render_graph.read(geo_pass, rg_depth, RG_DEPTH_ATTACHMENT_READ_ONLY);
+	}
+	else {
+		render_graph.write(geo_pass, rg_depth, RG_DEPTH_ATTACHMENT, true);
+	}
+	render_graph.write(geo_pass, rg_draw, RG_COLOR_ATTACHMENT, true);
+
+	//SDSM, the visible depth range is reduced here & read back by this frame slot's next draw()
+	if (depth_reduce_active) {
+		uint32_t reduce_pass = render_graph.add_pass("depth_reduce", [this](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "depth_reduce");
+			reduce_depth(cmd);
+			profiler.end_zone(cmd, frame_number, zone);
+		}, true);
+		render_graph.read(reduce_pass, rg_depth, RG_SAMPLED_COMPUTE);
+		frames.at(frame_number).depth_bounds_pending = true;
+	}
+
+	if (compute_present) {
+		uint32_t tonemap_pass = render_graph.add_pass("tonemap", [this, swapchain_index](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, present_tonemap ? "tonemap" : "compute_copy");
+			tonemap(cmd, swapchain_index);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.read(tonemap_pass, rg_draw, RG_SAMPLED_COMPUTE);
+		render_graph.write(tonemap_pass, rg_swapchain, RG_STORAGE_COMPUTE, true);
+	}
+	else {
+		uint32_t blit_pass = render_graph.add_pass("blit", [this, swapchain_index](VkCommandBuffer cmd) {
+			uint32_t zone = profiler.begin_zone(cmd, frame_number, "blit");
+			copy_image(cmd, draw_image.image, swapchain_images.at(swapchain_index), draw_extent, swapchain_extent);
+			profiler.end_zone(cmd, frame_number, zone);
+		});
+		render_graph.read(blit_pass, rg_draw, RG_TRANSFER_SRC);
+		render_graph.write(blit_pass, rg_swapchain, RG_TRANSFER_DST, true);
+	}
+
+	uint32_t present_pass = render_graph.add_pass("present", nullptr, true);
+	render_graph.read(present_pass, rg_swapchain, RG_PRESENT);
+
+	render_graph.cull();
+	update_render_targets();
+	render_graph.build_barriers();
+	if (compute_present) {
+		write_tonemap_set(swapchain_index);
+	}
+	if (depth_reduce_active) {
+		write_depth_reduce_set();
+	}
+
+	std::string signature = render_graph.signature();
+	if (signature != graph_signature || dump_graph_requested) {
+		graph_signature = signature;
+		dump_graph_requested = false;
+		LOG(2, render_graph.dump());
+	}
+}
+
+/*
+hands this frame's transient targets & their lifetimes to transient_pool
+when the description changes the targets are reallocated and the graph pointed at the new images
+*/
+void Engine::update_render_targets() {
+	transient_pool.begin();
+
+	uint32_t first = 0;
+	uint32_t last = 0;
+	TransientImageDesc draw_desc = {};
+	draw_desc.format = draw_image.format;
+	draw_desc.extent = draw_image.extent;
+	draw_desc.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	draw_desc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	render_graph.lifetime(rg_draw, first, last);
+	uint32_t draw_target = transient_pool.request("draw_image", draw_desc, first, last);
+
+	TransientImageDesc depth_desc = {};
+	depth_desc.format = depth_image.format;
+	depth_desc.extent = depth_image.extent;
+	depth_desc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (depth_reduce_active ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+	depth_desc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+	render_graph.lifetime(rg_depth, first, last);
+	uint32_t depth_target = transient_pool.request("depth_image", depth_desc, first, last);
+
+	if (!transient_pool.needs_build()) {
+		return;
+	}
+	if (!transient_pool.images.empty()) {
+		//earlier frames in flight may still be using the old targets
+		transient_pool.retire(deletion_queue, frame_counter);
+		resize_hitch_pending = true;
+	}
+	transient_pool.build(device, vma_allocator);
+
+	RGImageState undefined = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE };
+	draw_image = transient_pool.images[draw_target].data;
+	depth_image = transient_pool.images[depth_target].data;
+	render_graph.set_image(rg_draw, draw_image.image, undefined);
+	render_graph.set_image(rg_depth, depth_image.image, undefined);
+	render_graph.set_alias_group(rg_draw, transient_pool.alias_group(draw_target));
+	render_graph.set_alias_group(rg_depth, transient_pool.alias_group(depth_target));
+
+	VkDeviceSize shadowmap_bytes = 0;
+	VmaAllocationInfo shadowmap_info = {};
+	vmaGetAllocationInfo(vma_allocator, shadowmap_image.allocation, &shadowmap_info);
+	shadowmap_bytes = shadowmap_info.size;
+
+	LOG(2, "Render targets: " + std::to_string(transient_pool.allocated_bytes / 1024) + "KB transient ("
+		+ std::to_string(transient_pool.requested_bytes / 1024) + "KB unaliased, "
+		+ std::to_string(transient_pool.lazy_count) + " lazily allocated), "
+		+ std::to_string(shadowmap_bytes / 1024) + "KB shadowmap");
+}
+
+/*
+points this frame's tonemap set at draw_image & the acquired swapchain image
+the set was last used by this frame slot's previous submission, which its fence has retired
+*/
+void Engine::write_tonemap_set(uint32_t swapchain_index) {
+	VkDescriptorImageInfo draw_info = {};
+	draw_info.sampler = blit_sampler;
+	draw_info.imageView = draw_image.view;
+	draw_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorImageInfo swapchain_info = {};
+	swapchain_info.imageView = swapchain_image_views.at(swapchain_index);
+	swapchain_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet writes[2] = {};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].pNext = nullptr;
+	writes[0].dstBinding = 0;
+	writes[0].dstSet = tonemap_sets.at(frame_number);
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].pImageInfo = &draw_info;
+
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].pNext = nullptr;
+	writes[1].dstBinding = 1;
+	writes[1].dstSet = tonemap_sets.at(frame_number);
+	writes[1].descriptorCount = 1;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].pImageInfo = &swapchain_info;
+	vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+}
+
+/*
+one read of draw_extent, filtered up to the swapchain size, one write of the swapchain image
+replaces the blit and its transfer layouts, without present_tonemap it is a plain copy to time against the blit
+*/
+void Engine::tonemap(VkCommandBuffer cmd, uint32_t swapchain_index) {
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, tonemap_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, tonemap_pipeline_layout, 0, 1, &tonemap_sets.at(frame_number), 0, nullptr);
+
+	TonemapPushConstants pcs = {};
+	pcs.uv_scale = glm::vec2((float)draw_extent.width / draw_image.extent.width, (float)draw_extent.height / draw_image.extent.height);
+	pcs.dst_extent = glm::ivec2(swapchain_extent.width, swapchain_extent.height);
+	pcs.exposure = 1.0f;
+	pcs.tonemap = present_tonemap ? 1 : 0;
+	vkCmdPushConstants(cmd, tonemap_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TonemapPushConstants), &pcs);
+
+	vkCmdDispatch(cmd, (swapchain_extent.width + 7) / 8, (swapchain_extent.height + 7) / 8, 1);
+}
+
 /*
 
 */
@@ -133,16 +512,26 @@ void Engine::draw_geo(VkCommandBuffer cmd) {
 	color_attachment.pNext = nullptr;
 	color_attachment.imageView = draw_image.view;
 	color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	//the graph declares this write a discard, draw_image arrives undefined, pooled memory may hold another target
+	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_attachment.clearValue.color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
 
 	VkRenderingAttachmentInfo depth_attachment = {};
 	depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
 	depth_attachment.pNext = nullptr;
 	depth_attachment.imageView = depth_image.view;
-	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	if (depth_prepass_active) {
+		depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_NONE;
+	}
+	else {
+		//only the depth reduction reads depth after this pass, without it lazily allocated depth stays in tile memory
+		depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		depth_attachment.storeOp = depth_reduce_active ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	}
 	depth_attachment.clearValue.depthStencil.depth = 0.0f;
 
 	VkRenderingInfo rendering_info = {};
@@ -154,92 +543,672 @@ void Engine::draw_geo(VkCommandBuffer cmd) {
 	rendering_info.pColorAttachments = &color_attachment;
 	rendering_info.pDepthAttachment = &depth_attachment;
 	rendering_info.pStencilAttachment = nullptr;
+	if (parallel_recording) {
+		rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+	}
 
 	vkCmdBeginRendering(cmd, &rendering_info);
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline_layout, 0, 1, &global_set, 0, nullptr);
+	if (parallel_recording) {
+		PerFrameData& frame = frames.at(frame_number);
+		vkCmdExecuteCommands(cmd, (uint32_t)frame.worker_geo_cmds.size(), frame.worker_geo_cmds.data());
+	}
+	else {
+		set_viewport_scissor(cmd, draw_extent);
+		BindState state = {};
+		record_draws(cmd, draw_list.pass_range(GEO_PASS), state);
+		stats.draw_calls += state.draws;
+		stats.binds += state.binds;
+		stats.descriptor_binds += state.descriptor_binds;
+		stats.descriptor_bind_us += state.descriptor_bind_us;
+	}
+	vkCmdEndRendering(cmd);
+}
 
-	VkViewport viewport = {};
-	viewport.x = 0;
-	viewport.y = 0;
-	viewport.width = draw_extent.width;
-	viewport.height = draw_extent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	vkCmdSetViewport(cmd, 0, 1, &viewport);
+/*
+every layer of target in one pass, the layer or atlas tile of each draw comes from its draw command
+clears is ignored when clear_all clears the whole target, otherwise the rest keeps the depth already in it
+*/
+void Engine::draw_shadowmaps(VkCommandBuffer cmd, const ImageData& target, uint32_t layer_count, std::span<const DrawCommand> draws, const std::vector<VkCommandBuffer>& secondaries, bool clear_all, std::span<const VkClearRect> clears) {
+	VkRenderingAttachmentInfo depth_attachment = {};
+	depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	depth_attachment.pNext = nullptr;
+	depth_attachment.imageView = target.view;
+	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+	depth_attachment.loadOp = clear_all ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
+	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depth_attachment.clearValue.depthStencil.depth = 0.0f;
 
-	VkRect2D scissor = {};
-	scissor.offset.x = 0;
-	scissor.offset.y = 0;
-	scissor.extent.width = draw_extent.width;
-	scissor.extent.height = draw_extent.height;
-	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	VkExtent2D sm_extent = {};
+	sm_extent.width = target.extent.width;
+	sm_extent.height = target.extent.height;
 
+	VkRenderingInfo rendering_info = {};
+	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	rendering_info.pNext = nullptr;
+	rendering_info.renderArea = VkRect2D{ VkOffset2D { 0, 0 }, sm_extent };
+	rendering_info.layerCount = layer_count;		//shadow.vert routes each draw to its cascade with gl_Layer
+	rendering_info.colorAttachmentCount = 0;
+	rendering_info.pColorAttachments = nullptr;
+	rendering_info.pDepthAttachment = &depth_attachment;
+	rendering_info.pStencilAttachment = nullptr;
+	if (parallel_recording) {
+		rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+	}
 
-	PushConstants pcs;
-	for (const MeshData& mesh : meshes) {
-		pcs.vb_addr = mesh.vertex_buffer_address;
-		pcs.model = mesh.model_mat;
-		vkCmdPushConstants(cmd, mesh_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pcs);
-		vkCmdBindIndexBuffer(cmd, mesh.index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(cmd, mesh.index_count, 1, 0, 0, 0);
+	vkCmdBeginRendering(cmd, &rendering_info);
+	if (parallel_recording) {
+		vkCmdExecuteCommands(cmd, (uint32_t)secondaries.size(), secondaries.data());
+	}
+	else {
+		set_viewport_scissor(cmd, sm_extent);
+		if (!clear_all) {
+			clear_depth_rects(cmd, clears);
+		}
+		BindState state = {};
+		record_draws(cmd, draws, state);
+		stats.draw_calls += state.draws;
+		stats.binds += state.binds;
+		stats.descriptor_binds += state.descriptor_binds;
+		stats.descriptor_bind_us += state.descriptor_bind_us;
 	}
 	vkCmdEndRendering(cmd);
 }
 
-void Engine::draw_shadowmaps(VkCommandBuffer cmd) {
+/*
+whole layers of the cascades in clear_mask
+*/
+std::vector<VkClearRect> Engine::cascade_clear_rects(uint32_t clear_mask) {
+	std::vector<VkClearRect> rects;
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		if (((clear_mask >> c) & 1) == 0) {
+			continue;
+		}
+		VkClearRect rect = {};
+		rect.rect = VkRect2D{ VkOffset2D { 0, 0 }, VkExtent2D { shadowmap_image.extent.width, shadowmap_image.extent.height } };
+		rect.baseArrayLayer = c;
+		rect.layerCount = 1;
+		rects.push_back(rect);
+	}
+	return rects;
+}
+
+/*
+tiles of the spot lights redrawn this frame
+*/
+std::vector<VkClearRect> Engine::atlas_clear_rects() {
+	std::vector<VkClearRect> rects;
+	for (const SpotLight& light : spot_lights) {
+		if (!light.dirty) {
+			continue;
+		}
+		VkClearRect rect = {};
+		rect.rect = VkRect2D{ VkOffset2D { (int32_t)light.tile.x, (int32_t)light.tile.y }, VkExtent2D { light.tile.size, light.tile.size } };
+		rect.baseArrayLayer = 0;
+		rect.layerCount = 1;
+		rects.push_back(rect);
+	}
+	return rects;
+}
 
+/*
+cube faces of the point lights redrawn this frame, a face is layer 6 * light + face
+*/
+std::vector<VkClearRect> Engine::point_clear_rects() {
+	std::vector<VkClearRect> rects;
+	for (uint32_t l = 0; l < point_lights.size(); l++) {
+		for (uint32_t f = 0; f < 6; f++) {
+			if (((point_lights[l].dirty_mask >> f) & 1) == 0) {
+				continue;
+			}
+			VkClearRect rect = {};
+			rect.rect = VkRect2D{ VkOffset2D { 0, 0 }, VkExtent2D { point_image.extent.width, point_image.extent.height } };
+			rect.baseArrayLayer = 6 * l + f;
+			rect.layerCount = 1;
+			rects.push_back(rect);
+		}
+	}
+	return rects;
+}
+
+/*
+clears parts of the depth attachment inside a shadow pass that loaded the rest
+*/
+void Engine::clear_depth_rects(VkCommandBuffer cmd, std::span<const VkClearRect> rects) {
+	if (rects.empty()) {
+		return;
+	}
+	VkClearAttachment clear = {};
+	clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	clear.clearValue.depthStencil.depth = 0.0f;
+	vkCmdClearAttachments(cmd, 1, &clear, (uint32_t)rects.size(), rects.data());
+}
+
+/*
+every cascade of the static cache into the shadow map, the dynamic casters are drawn over it next
+*/
+void Engine::copy_shadow_cache(VkCommandBuffer cmd) {
+	VkImageCopy2 region = {};
+	region.sType = VK_STRUCTURE_TYPE_IMAGE_COPY_2;
+	region.pNext = nullptr;
+	region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	region.srcSubresource.mipLevel = 0;
+	region.srcSubresource.baseArrayLayer = 0;
+	region.srcSubresource.layerCount = cascades.count;
+	region.dstSubresource = region.srcSubresource;
+	region.extent = shadowmap_image.extent;
+
+	VkCopyImageInfo2 copy_info = {};
+	copy_info.sType = VK_STRUCTURE_TYPE_COPY_IMAGE_INFO_2;
+	copy_info.pNext = nullptr;
+	copy_info.srcImage = shadow_cache_image.image;
+	copy_info.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	copy_info.dstImage = shadowmap_image.image;
+	copy_info.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	copy_info.regionCount = 1;
+	copy_info.pRegions = &region;
+	vkCmdCopyImage2(cmd, &copy_info);
+}
+
+/*
+axis 0 warps shadow map depth into moments & blurs them horizontally, axis 1 blurs vertically into mip 0
+every cascade at once, a dispatch layer per cascade
+*/
+void Engine::blur_moments(VkCommandBuffer cmd, uint32_t axis) {
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, moments_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, moments_pipeline_layout, 0, 1, &moments_sets[axis], 0, nullptr);
+
+	MomentsPushConstants pcs = {};
+	pcs.direction = axis == 0 ? glm::ivec2(1, 0) : glm::ivec2(0, 1);
+	pcs.warp = axis == 0 ? 1 : 0;
+	pcs.exponent = mesh_shading.options.evsm_exponent;
+	vkCmdPushConstants(cmd, moments_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MomentsPushConstants), &pcs);
+
+	vkCmdDispatch(cmd, (moments_image.extent.width + 7) / 8, (moments_image.extent.height + 7) / 8, cascades.count);
+}
+
+/*
+points this frame's reduction set at depth_image, which the transient pool may have replaced since it was last used
+*/
+void Engine::write_depth_reduce_set() {
+	VkDescriptorImageInfo depth_info = {};
+	depth_info.sampler = shadowmap_sampler;
+	depth_info.imageView = depth_image.view;
+	depth_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorBufferInfo bounds_info = {};
+	bounds_info.buffer = frames.at(frame_number).depth_bounds_buffer.buffer;
+	bounds_info.offset = 0;
+	bounds_info.range = sizeof(DepthBounds);
+
+	VkWriteDescriptorSet writes[2] = {};
+	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[0].pNext = nullptr;
+	writes[0].dstBinding = 0;
+	writes[0].dstSet = depth_reduce_sets.at(frame_number);
+	writes[0].descriptorCount = 1;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].pImageInfo = &depth_info;
+
+	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[1].pNext = nullptr;
+	writes[1].dstBinding = 1;
+	writes[1].dstSet = depth_reduce_sets.at(frame_number);
+	writes[1].descriptorCount = 1;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[1].pBufferInfo = &bounds_info;
+	vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+}
+
+/*
+min & max view depth of every pixel drawn this frame into the frame's readback buffer
+the buffer is reset first, and made visible to the host once the fence signals
+*/
+void Engine::reduce_depth(VkCommandBuffer cmd) {
+	const BufferData& bounds = frames.at(frame_number).depth_bounds_buffer;
+	DepthBounds empty = { UINT32_MAX, 0 };
+	vkCmdUpdateBuffer(cmd, bounds.buffer, 0, sizeof(DepthBounds), &empty);
+
+	VkBufferMemoryBarrier2 barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+	barrier.pNext = nullptr;
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = bounds.buffer;
+	barrier.offset = 0;
+	barrier.size = sizeof(DepthBounds);
+
+	VkDependencyInfo dependency = {};
+	dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependency.pNext = nullptr;
+	dependency.bufferMemoryBarrierCount = 1;
+	dependency.pBufferMemoryBarriers = &barrier;
+	vkCmdPipelineBarrier2(cmd, &dependency);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depth_reduce_pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depth_reduce_pipeline_layout, 0, 1, &depth_reduce_sets.at(frame_number), 0, nullptr);
+
+	DepthReducePushConstants pcs = {};
+	pcs.extent = glm::ivec2(draw_extent.width, draw_extent.height);
+	pcs.near_plane = camera.near_plane;
+	pcs.far_plane = camera.far_plane;
+	vkCmdPushConstants(cmd, depth_reduce_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReducePushConstants), &pcs);
+
+	vkCmdDispatch(cmd, (draw_extent.width + 15) / 16, (draw_extent.height + 15) / 16, 1);
+
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+	barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+	barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+	barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+	vkCmdPipelineBarrier2(cmd, &dependency);
+}
+
+/*
+this frame slot's bounds from frames_in_flight frames ago, its fence has just been waited on so nothing stalls
+a fitted range that moved refits the cascades in this frame's uniform update
+*/
+void Engine::read_depth_bounds() {
+	PerFrameData& frame = frames.at(frame_number);
+	if (!frame.depth_bounds_pending) {
+		return;
+	}
+	frame.depth_bounds_pending = false;
+	VK_CHECK(vmaInvalidateAllocation(vma_allocator, frame.depth_bounds_buffer.allocation, 0, VK_WHOLE_SIZE));
+	DepthBounds bounds = *(const DepthBounds*)frame.depth_bounds_buffer.info.pMappedData;
+	if (sample_distribution.enabled && sample_distribution.update(bounds, camera.near_plane, camera.far_plane)) {
+		cascade_camera_version = 0;
+	}
+}
+
+/*
+blits each mip of moments_image from the one above it, every cascade layer per blit
+the graph hands the whole image over in TRANSFER_DST and gets it back that way
+*/
+void Engine::generate_moment_mips(VkCommandBuffer cmd) {
+	VkImageMemoryBarrier2 barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	barrier.pNext = nullptr;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = moments_image.image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = cascades.count;
+
+	VkDependencyInfo dep_info = {};
+	dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dep_info.pNext = nullptr;
+	dep_info.imageMemoryBarrierCount = 1;
+	dep_info.pImageMemoryBarriers = &barrier;
+
+	int32_t width = (int32_t)moments_image.extent.width;
+	int32_t height = (int32_t)moments_image.extent.height;
+	for (uint32_t level = 1; level < moments_mips; level++) {
+		//the level above was just written, it becomes the blit source
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		vkCmdPipelineBarrier2(cmd, &dep_info);
+
+		VkImageBlit2 blit = {};
+		blit.sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2;
+		blit.pNext = nullptr;
+		blit.srcOffsets[1] = { width, height, 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = cascades.count;
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+		blit.dstOffsets[1] = { width, height, 1 };
+		blit.dstSubresource = blit.srcSubresource;
+		blit.dstSubresource.mipLevel = level;
+
+		VkBlitImageInfo2 blit_info = {};
+		blit_info.sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2;
+		blit_info.pNext = nullptr;
+		blit_info.srcImage = moments_image.image;
+		blit_info.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		blit_info.dstImage = moments_image.image;
+		blit_info.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		blit_info.regionCount = 1;
+		blit_info.pRegions = &blit;
+		blit_info.filter = VK_FILTER_LINEAR;
+		vkCmdBlitImage2(cmd, &blit_info);
+	}
+
+	//back to the single layout the graph tracks, the last level never left it
+	if (moments_mips > 1) {
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_NONE;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = moments_mips - 1;
+		vkCmdPipelineBarrier2(cmd, &dep_info);
+	}
+}
+
+/*
+depth only, writes depth_image with the camera matrices so draw_geo shades each pixel once
+*/
+void Engine::draw_depth_prepass(VkCommandBuffer cmd) {
 	VkRenderingAttachmentInfo depth_attachment = {};
 	depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
 	depth_attachment.pNext = nullptr;
-	depth_attachment.imageView = shadowmap_image.view;
+	depth_attachment.imageView = depth_image.view;
 	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
 	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depth_attachment.clearValue.depthStencil.depth = 0.0f;
 
-	VkExtent2D sm_extent = {};
-	sm_extent.width = shadowmap_image.extent.width;
-	sm_extent.height = shadowmap_image.extent.height;
-
 	VkRenderingInfo rendering_info = {};
 	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
 	rendering_info.pNext = nullptr;
-	rendering_info.renderArea = VkRect2D{ VkOffset2D { 0, 0 }, sm_extent };
+	rendering_info.renderArea = VkRect2D{ VkOffset2D { 0, 0 }, draw_extent };
 	rendering_info.layerCount = 1;
 	rendering_info.colorAttachmentCount = 0;
 	rendering_info.pColorAttachments = nullptr;
 	rendering_info.pDepthAttachment = &depth_attachment;
 	rendering_info.pStencilAttachment = nullptr;
+	if (parallel_recording) {
+		rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+	}
 
 	vkCmdBeginRendering(cmd, &rendering_info);
-	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline_layout, 0, 1, &global_set, 0, nullptr);
+	if (parallel_recording) {
+		PerFrameData& frame = frames.at(frame_number);
+		vkCmdExecuteCommands(cmd, (uint32_t)frame.worker_prepass_cmds.size(), frame.worker_prepass_cmds.data());
+	}
+	else {
+		set_viewport_scissor(cmd, draw_extent);
+		BindState state = {};
+		record_draws(cmd, draw_list.pass_range(DEPTH_PREPASS), state);
+		stats.draw_calls += state.draws;
+		stats.binds += state.binds;
+		stats.descriptor_binds += state.descriptor_binds;
+		stats.descriptor_bind_us += state.descriptor_bind_us;
+	}
+	vkCmdEndRendering(cmd);
+}
+
+/*
+one geo command per batch and one shadow command per cascade the batch's bounds reach, sorted so state changes are grouped
+static casters only go to cascades shadow_cache marked dirty, dynamic casters to every cascade they reach
+spot casters only go to atlas tiles redrawn this frame, sorted by light so the viewport changes once per tile
+point casters get one command per dirty cube face their bounds reach, most only reach a face or two of a light
+opaque geo is front to back from the eye, shadow casters front to back from the light
+with the depth pre-pass on, geo also gets a pre-pass command and shades with an EQUAL test
+*/
+void Engine::build_draw_list() {
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	glm::vec3 eye = glm::vec3(glm::inverse(ubo_data.view)[3]);
+
+	draw_list.clear();
+	std::fill(std::begin(cascades.casters), std::end(cascades.casters), 0);
+	cascades.culled = 0;
+	for (uint32_t i = 0; i < draw_batches.size(); i++) {
+		const DrawBatch& batch = draw_batches[i];
+		float light_depth = glm::distance(sun.pos, batch.center) / draw_list.max_depth;
+		float eye_depth = glm::distance(eye, batch.center) / draw_list.max_depth;
+		DRAWPASS shadow_pass = batch.dynamic ? SHADOW_DYNAMIC_PASS : SHADOW_PASS;
+		for (uint32_t c = 0; c < cascades.count; c++) {
+			if (!batch.dynamic && !shadow_cache.dirty(c)) {
+				continue;
+			}
+			if (!cascades.intersects(c, batch.bounds_min, batch.bounds_max)) {
+				cascades.culled++;
+				continue;
+			}
+			draw_list.push(DrawList::make_key(shadow_pass, SHADOW_PIPELINE_ID, batch.material_id, batch.mesh_id, light_depth), i, c);
+			cascades.casters[c]++;
+		}
+		for (uint32_t l = 0; l < spot_lights.size(); l++) {
+			const SpotLight& light = spot_lights[l];
+			if (!light.dirty || !ShadowAtlas::intersects(light.view_proj, batch.bounds_min, batch.bounds_max)) {
+				continue;
+			}
+			float spot_depth = glm::distance(light.pos, batch.center) / draw_list.max_depth;
+			draw_list.push(DrawList::make_key(SPOT_SHADOW_PASS, SHADOW_PIPELINE_ID, l, batch.mesh_id, spot_depth), i, MAX_SHADOW_CASCADES + l);
+		}
+		for (uint32_t l = 0; l < point_lights.size(); l++) {
+			const PointLight& light = point_lights[l];
+			if (light.dirty_mask == 0) {
+				continue;
+			}
+			uint32_t faces = PointShadows::face_mask(light, batch.bounds_min, batch.bounds_max);
+			float point_depth = glm::distance(light.pos, batch.center) / draw_list.max_depth;
+			for (uint32_t f = 0; f < 6; f++) {
+				if (((light.dirty_mask >> f) & 1) == 0) {
+					continue;
+				}
+				if (((faces >> f) & 1) == 0) {
+					point_shadows.culled++;
+					continue;
+				}
+				draw_list.push(DrawList::make_key(POINT_SHADOW_PASS, POINT_SHADOW_PIPELINE_ID, 6 * l + f, batch.mesh_id, point_depth), i, POINT_LAYER_BASE + 6 * l + f);
+				point_shadows.casters++;
+			}
+		}
+		if (depth_prepass_active) {
+			draw_list.push(DrawList::make_key(DEPTH_PREPASS, DEPTH_PREPASS_PIPELINE_ID, 0, batch.mesh_id, eye_depth), i);
+			draw_list.push(DrawList::make_key(GEO_PASS, MESH_EQUAL_PIPELINE_ID, batch.material_id, batch.mesh_id, eye_depth), i);
+		}
+		else {
+			draw_list.push(DrawList::make_key(GEO_PASS, MESH_PIPELINE_ID, batch.material_id, batch.mesh_id, eye_depth), i);
+		}
+	}
+	draw_list.sort();
+
+	auto stop_time = std::chrono::high_resolution_clock::now();
+	stats.sort_time_us = std::chrono::duration<float, std::micro>(stop_time - start_time).count();
+}
+
+/*
+records sorted draws, only rebinding state that differs from the last draw
+*/
+void Engine::record_draws(VkCommandBuffer cmd, std::span<const DrawCommand> draws, BindState& state) {
+	PushConstants pcs;
+	pcs.instance_addr = frame_ring.slice_address(frame_number) + ring_instance_offset;
+	uint32_t ubo_offset = (uint32_t)frame_ring.slice_offset(frame_number);
+
+	for (const DrawCommand& draw : draws) {
+		const DrawBatch& batch = draw_batches[draw.batch];
+		const PipelineBinding& binding = pipeline_table[DrawList::key_pipeline(draw.key)];
+
+		if (binding.pipeline != state.pipeline) {
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, binding.pipeline);
+			state.pipeline = binding.pipeline;
+			state.binds++;
+		}
+		if (binding.layout != state.layout || global_set != state.set) {
+			auto bind_start = std::chrono::high_resolution_clock::now();
+			if (descriptor_buffer_enabled) {
+				if (!state.descriptor_buffer_bound) {
+					descriptor_buffer.bind_buffer(cmd);
+					state.descriptor_buffer_bound = true;
+				}
+				descriptor_buffer.bind_set(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, binding.layout, frame_number);
+			}
+			else {
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, binding.layout, 0, 1, &global_set, 1, &ubo_offset);
+			}
+			state.descriptor_bind_us += std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - bind_start).count();
+			state.descriptor_binds++;
+			state.layout = binding.layout;
+			state.set = global_set;
+			state.vb_addr = 0;
+			state.binds++;
+		}
+		if (draw.layer != state.layer && draw.layer >= MAX_SHADOW_CASCADES && draw.layer < POINT_LAYER_BASE) {
+			const AtlasTile& tile = spot_lights[draw.layer - MAX_SHADOW_CASCADES].tile;
+			set_viewport_scissor(cmd, VkExtent2D{ tile.size, tile.size }, VkOffset2D{ (int32_t)tile.x, (int32_t)tile.y });
+		}
+		if (batch.vertex_buffer_address != state.vb_addr || draw.layer != state.layer) {
+			pcs.vb_addr = batch.vertex_buffer_address;
+			pcs.layer = draw.layer;
+			vkCmdPushConstants(cmd, binding.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pcs);
+			state.vb_addr = batch.vertex_buffer_address;
+			state.layer = draw.layer;
+		}
+		if (batch.index_buffer != state.index_buffer) {
+			vkCmdBindIndexBuffer(cmd, batch.index_buffer, 0, VK_INDEX_TYPE_UINT32);
+			state.index_buffer = batch.index_buffer;
+			state.binds++;
+		}
+
+		vkCmdDrawIndexed(cmd, batch.index_count, batch.instance_count, 0, 0, batch.first_instance);
+		state.draws++;
+	}
+}
 
+static std::span<const DrawCommand> worker_slice(std::span<const DrawCommand> draws, uint32_t worker, uint32_t worker_count) {
+	size_t first = draws.size() * worker / worker_count;
+	size_t last = draws.size() * (worker + 1) / worker_count;
+	return draws.subspan(first, last - first);
+}
+
+/*
+splits every pass of the sorted draw list into one contiguous slice per worker
+each worker resets its own pool and records a secondary buffer per pass
+slices are executed in worker order so draw order matches serial recording
+*/
+void Engine::record_secondaries() {
+	PerFrameData& frame = frames.at(frame_number);
+	//without a dynamic pass the shadow pass draws both ranges straight into the shadow map
+	std::span<const DrawCommand> shadow_draws = shadow_cache.has_dynamic ? draw_list.pass_range(SHADOW_PASS) : draw_list.pass_range(SHADOW_PASS, SHADOW_DYNAMIC_PASS);
+	std::span<const DrawCommand> shadow_dynamic_draws = draw_list.pass_range(SHADOW_DYNAMIC_PASS);
+	std::span<const DrawCommand> atlas_draws = draw_list.pass_range(SPOT_SHADOW_PASS);
+	std::span<const DrawCommand> point_draws = draw_list.pass_range(POINT_SHADOW_PASS);
+	std::span<const DrawCommand> prepass_draws = draw_list.pass_range(DEPTH_PREPASS);
+	std::span<const DrawCommand> geo_draws = draw_list.pass_range(GEO_PASS);
+
+	VkExtent2D sm_extent = {};
+	sm_extent.width = shadowmap_image.extent.width;
+	sm_extent.height = shadowmap_image.extent.height;
+
+	VkCommandBufferInheritanceRenderingInfo shadow_rendering = {};
+	shadow_rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+	shadow_rendering.pNext = nullptr;
+	shadow_rendering.colorAttachmentCount = 0;
+	shadow_rendering.depthAttachmentFormat = shadowmap_image.format;
+	shadow_rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkExtent2D atlas_extent = {};
+	atlas_extent.width = atlas_image.extent.width;
+	atlas_extent.height = atlas_image.extent.height;
+
+	VkExtent2D point_extent = {};
+	point_extent.width = point_image.extent.width;
+	point_extent.height = point_image.extent.height;
+
+	VkCommandBufferInheritanceRenderingInfo prepass_rendering = {};
+	prepass_rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+	prepass_rendering.pNext = nullptr;
+	prepass_rendering.colorAttachmentCount = 0;
+	prepass_rendering.depthAttachmentFormat = depth_image.format;
+	prepass_rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkCommandBufferInheritanceRenderingInfo geo_rendering = {};
+	geo_rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+	geo_rendering.pNext = nullptr;
+	geo_rendering.colorAttachmentCount = 1;
+	geo_rendering.pColorAttachmentFormats = &draw_image.format;
+	geo_rendering.depthAttachmentFormat = depth_image.format;
+	geo_rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	//a partially dirty shadow pass loads the shadow map, the first worker clears the dirty cascades
+	//the atlas pass always loads, the first worker clears the dirty tiles, as does the point pass with its dirty faces
+	uint32_t all_cascades = (1u << cascades.count) - 1;
+	std::vector<VkClearRect> cascade_clears = shadow_cache.dirty_mask != all_cascades ? cascade_clear_rects(shadow_cache.dirty_mask) : std::vector<VkClearRect>();
+	std::vector<VkClearRect> atlas_clears = atlas_clear_rects();
+	bool atlas_dirty = shadow_atlas.any_dirty(spot_lights);
+	bool all_faces = std::all_of(point_lights.begin(), point_lights.end(), [](const PointLight& light) { return light.dirty_mask == 0x3F; });
+	std::vector<VkClearRect> point_clears = all_faces ? std::vector<VkClearRect>() : point_clear_rects();
+	bool point_dirty = point_shadows.any_dirty(point_lights);
+
+	std::vector<BindState> states(worker_count * 6, BindState{});
+	std::vector<std::future<void>> recorded;
+	for (uint32_t w = 0; w < worker_count; w++) {
+		recorded.push_back(workers.submit([&, w]() {
+			VK_CHECK(vkResetCommandPool(device, frame.worker_pools[w], 0));
+			if (shadow_cache.dirty_mask != 0) {
+				record_secondary(frame.worker_shadow_cmds[w], shadow_rendering, sm_extent, worker_slice(shadow_draws, w, worker_count), states[w * 6],
+					w == 0 ? std::span<const VkClearRect>(cascade_clears) : std::span<const VkClearRect>());
+			}
+			if (shadow_cache.has_dynamic) {
+				record_secondary(frame.worker_shadow_dynamic_cmds[w], shadow_rendering, sm_extent, worker_slice(shadow_dynamic_draws, w, worker_count), states[w * 6 + 1]);
+			}
+			if (atlas_dirty) {
+				record_secondary(frame.worker_atlas_cmds[w], shadow_rendering, atlas_extent, worker_slice(atlas_draws, w, worker_count), states[w * 6 + 2],
+					w == 0 ? std::span<const VkClearRect>(atlas_clears) : std::span<const VkClearRect>());
+			}
+			if (point_dirty) {
+				record_secondary(frame.worker_point_cmds[w], shadow_rendering, point_extent, worker_slice(point_draws, w, worker_count), states[w * 6 + 5],
+					w == 0 ? std::span<const VkClearRect>(point_clears) : std::span<const VkClearRect>());
+			}
+			if (depth_prepass_active) {
+				record_secondary(frame.worker_prepass_cmds[w], prepass_rendering, draw_extent, worker_slice(prepass_draws, w, worker_count), states[w * 6 + 3]);
+			}
+			record_secondary(frame.worker_geo_cmds[w], geo_rendering, draw_extent, worker_slice(geo_draws, w, worker_count), states[w * 6 + 4]);
+		}));
+	}
+	for (std::future<void>& done : recorded) {
+		done.get();
+	}
+
+	for (const BindState& state : states) {
+		stats.draw_calls += state.draws;
+		stats.binds += state.binds;
+		stats.descriptor_binds += state.descriptor_binds;
+		stats.descriptor_bind_us += state.descriptor_bind_us;
+	}
+}
+
+void Engine::record_secondary(VkCommandBuffer cmd, const VkCommandBufferInheritanceRenderingInfo& rendering, VkExtent2D extent, std::span<const DrawCommand> draws, BindState& state, std::span<const VkClearRect> clears) {
+	VkCommandBufferInheritanceInfo inheritance_info = {};
+	inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance_info.pNext = &rendering;
+	if (profiler.statistics_enabled) {
+		inheritance_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+	}
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.pNext = nullptr;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	begin_info.pInheritanceInfo = &inheritance_info;
+
+	VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+	set_viewport_scissor(cmd, extent);
+	clear_depth_rects(cmd, clears);
+	record_draws(cmd, draws, state);
+	VK_CHECK(vkEndCommandBuffer(cmd));
+}
+
+void Engine::set_viewport_scissor(VkCommandBuffer cmd, VkExtent2D extent, VkOffset2D offset) {
 	VkViewport viewport = {};
-	viewport.x = 0;
-	viewport.y = 0;
-	viewport.width = sm_extent.width;
-	viewport.height = sm_extent.height;
+	viewport.x = (float)offset.x;
+	viewport.y = (float)offset.y;
+	viewport.width = (float)extent.width;
+	viewport.height = (float)extent.height;
 	viewport.minDepth = 0.0f;
 	viewport.maxDepth = 1.0f;
 	vkCmdSetViewport(cmd, 0, 1, &viewport);
 
 	VkRect2D scissor = {};
-	scissor.offset.x = 0;
-	scissor.offset.y = 0;
-	scissor.extent.width = sm_extent.width;
-	scissor.extent.height = sm_extent.height;
+	scissor.offset = offset;
+	scissor.extent = extent;
 	vkCmdSetScissor(cmd, 0, 1, &scissor);
-
-
-	PushConstants pcs;
-	for (const MeshData& mesh : meshes) {
-		pcs.vb_addr = mesh.vertex_buffer_address;
-		pcs.model = mesh.model_mat;
-		vkCmdPushConstants(cmd, mesh_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pcs);
-		vkCmdBindIndexBuffer(cmd, mesh.index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(cmd, mesh.index_count, 1, 0, 0, 0);
-	}
-	vkCmdEndRendering(cmd);
 }
\ No newline at end of file
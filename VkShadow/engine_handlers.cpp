@@ -11,9 +11,104 @@ void Engine::handle_restore() {
 }
 
 void Engine::handle_keypress(int key, int scanecode, int action, int mods) {
-//TODO
+	if (action != GLFW_PRESS) {
+		return;
+	}
+	switch (key)
+	{
+	case GLFW_KEY_T:
+		spawn_instance_grid(model_res.teapot, 100000);
+		break;
+	case GLFW_KEY_P:
+		parallel_recording = !parallel_recording;
+		LOG(1, std::string("Parallel recording ") + (parallel_recording ? "on." : "off."));
+		break;
+	case GLFW_KEY_Z:
+		depth_prepass_enabled = !depth_prepass_enabled;
+		LOG(1, std::string("Depth pre-pass ") + (depth_prepass_enabled ? "on." : "off."));
+		break;
+	case GLFW_KEY_G:
+		dump_graph_requested = true;
+		break;
+	case GLFW_KEY_B:
+		//compute tonemap, compute copy, blit
+		if (compute_present_enabled && present_tonemap) {
+			present_tonemap = false;
+		}
+		else {
+			compute_present_enabled = !compute_present_enabled;
+			present_tonemap = true;
+		}
+		LOG(1, std::string("Present pass: ") + (compute_present_enabled && compute_present_supported ? (present_tonemap ? "compute tonemap." : "compute copy.") : "blit."));
+		break;
+	case GLFW_KEY_C:
+		two_sided = !two_sided;
+		LOG(1, std::string("Back face culling ") + (two_sided ? "off." : "on."));
+		break;
+	case GLFW_KEY_L:
+		mesh_shading.options.lighting_mode = (mesh_shading.options.lighting_mode + 1) % LIGHTING_MODE_COUNT;
+		LOG(1, "Lighting mode " + std::to_string(mesh_shading.options.lighting_mode) + ", variant " + std::to_string(mesh_shading.key()) + ".");
+		break;
+	case GLFW_KEY_M:
+		mesh_shading.options.shadow_mode = (mesh_shading.options.shadow_mode + 1) % SHADOW_MODE_COUNT;
+		LOG(1, "Shadow mode " + std::to_string(mesh_shading.options.shadow_mode) + ", variant " + std::to_string(mesh_shading.key()) + ".");
+		break;
+	case GLFW_KEY_F:
+		//4, 8, 16, 32 Poisson taps
+		mesh_shading.options.filter_taps = mesh_shading.options.filter_taps >= 32 ? 4 : mesh_shading.options.filter_taps * 2;
+		LOG(1, "Shadow filter taps " + std::to_string(mesh_shading.options.filter_taps) + ", variant " + std::to_string(mesh_shading.key()) + ".");
+		break;
+	case GLFW_KEY_K:
+		mesh_shading.options.cascade_blend = !mesh_shading.options.cascade_blend;
+		LOG(1, std::string("Cascade blending ") + (mesh_shading.options.cascade_blend ? "on" : "off") + ", variant " + std::to_string(mesh_shading.key()) + ".");
+		break;
+	case GLFW_KEY_O:
+		animating = !animating;
+		set_mesh_dynamic(model_res.bunny.file_path, animating);
+		LOG(1, std::string("Bunny animation ") + (animating ? "on." : "off."));
+		break;
+	case GLFW_KEY_X:
+		shadow_cache.enabled = !shadow_cache.enabled;
+		shadow_atlas.enabled = shadow_cache.enabled;
+		point_shadows.enabled = shadow_cache.enabled;
+		LOG(1, std::string("Shadow cache ") + (shadow_cache.enabled ? "on." : "off."));
+		break;
+	case GLFW_KEY_V:
+		spot_lights_enabled = !spot_lights_enabled;
+		spot_camera_version = 0;		//reassigns the atlas next frame
+		LOG(1, std::string("Spot lights ") + (spot_lights_enabled ? "on." : "off."));
+		break;
+	case GLFW_KEY_H:
+		sample_distribution.enabled = !sample_distribution.enabled;
+		sample_distribution.fitted = false;
+		cascade_camera_version = 0;		//back to the full range until the first readback
+		LOG(1, std::string("Sample distribution shadow maps ") + (sample_distribution.enabled ? "on." : "off."));
+		break;
+	case GLFW_KEY_J:
+		shadow_scheduler.enabled = !shadow_scheduler.enabled;
+		LOG(1, std::string("Shadow scheduler ") + (shadow_scheduler.enabled ? "on, " + std::to_string(shadow_scheduler.budget_ms) + "ms budget." : "off."));
+		break;
+	case GLFW_KEY_U:
+		unload_mesh(model_res.teapot.file_path);
+		break;
+	case GLFW_KEY_R:
+		resolution_scaler.enabled = !resolution_scaler.enabled;
+		LOG(1, std::string("Dynamic resolution ") + (resolution_scaler.enabled ? "on." : "off."));
+		break;
+	default:
+		break;
+	}
 }
 
 void Engine::handle_cursor_pos(double xpos, double ypos) {
-//TODO
+	glm::dvec2 cursor = glm::dvec2(xpos, ypos);
+	bool looking = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+	if (looking && camera.looking) {
+		glm::dvec2 delta = cursor - camera.last_cursor;
+		camera.yaw += (float)delta.x * camera.sensitivity;
+		camera.pitch = std::clamp(camera.pitch - (float)delta.y * camera.sensitivity, -89.0f, 89.0f);
+		camera_version++;
+	}
+	camera.looking = looking;
+	camera.last_cursor = cursor;
 }
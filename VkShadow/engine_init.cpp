@@ -70,12 +70,17 @@ void Engine::init_vulkan() {
 	};
 	features12.bufferDeviceAddress = true;
 	features12.descriptorIndexing = true;
+	features12.shaderOutputLayer = true;		//gl_Layer from shadow.vert, all cascades in one pass
+
+	VkPhysicalDeviceFeatures features = {};
+	features.imageCubeArray = VK_TRUE;			//every point light's cube sampled through one view
 
 	vkb::PhysicalDeviceSelector phys_device_selector{ vkb_instance };
 	vkb::Result<vkb::PhysicalDevice> physical_device_selector_return = phys_device_selector
 		.set_minimum_version(1, 3)
 		.set_required_features_13(features13)
 		.set_required_features_12(features12)
+		.set_required_features(features)
 		.set_surface(surface)
 		.select();
 	if (!physical_device_selector_return) {
@@ -84,6 +89,28 @@ void Engine::init_vulkan() {
 	vkb::PhysicalDevice vkb_phys_device = physical_device_selector_return.value();
 	phys_device = vkb_phys_device;
 
+	//optional, fragment invocation counts for pass measurements (inherited into secondaries)
+	VkPhysicalDeviceFeatures statistics_features = {};
+	statistics_features.pipelineStatisticsQuery = VK_TRUE;
+	statistics_features.inheritedQueries = VK_TRUE;
+	pipeline_statistics_supported = vkb_phys_device.enable_features_if_present(statistics_features);
+
+	//optional, anisotropic filtering of the EVSM moments
+	VkPhysicalDeviceFeatures anisotropy_features = {};
+	anisotropy_features.samplerAnisotropy = VK_TRUE;
+	anisotropy_supported = vkb_phys_device.enable_features_if_present(anisotropy_features);
+	max_anisotropy = std::min(vkb_phys_device.properties.limits.maxSamplerAnisotropy, 8.0f);
+	timestamp_period = vkb_phys_device.properties.limits.timestampPeriod;
+
+	//optional, global set written straight into a descriptor buffer instead of allocated from the pool
+	VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptor_buffer_features = {};
+	descriptor_buffer_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+	descriptor_buffer_features.descriptorBuffer = VK_TRUE;
+	bool descriptor_buffer_supported = config.descriptor_buffer
+		&& vkb_phys_device.enable_extension_if_present(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)
+		&& vkb_phys_device.enable_extension_features_if_present(descriptor_buffer_features);
+	uniform_alignment = std::max<VkDeviceSize>(vkb_phys_device.properties.limits.minUniformBufferOffsetAlignment, 16);
+
 	vkb::DeviceBuilder device_builder{ vkb_phys_device };
 	vkb::Result<vkb::Device> device_builder_return = device_builder.build();
 	if (!device_builder_return) {
@@ -91,6 +118,8 @@ void Engine::init_vulkan() {
 	}
 	vkb::Device vkb_device = device_builder_return.value();
 	device = vkb_device;
+	descriptor_buffer_enabled = descriptor_buffer_supported && descriptor_buffer.load(device, phys_device);
+	LOG(2, std::string("Global descriptors: ") + (descriptor_buffer_enabled ? "descriptor buffer." : "descriptor sets."));
 
 	vkb::Result<VkQueue> graphics_queue_return = vkb_device.get_queue(vkb::QueueType::graphics);
 	if (!graphics_queue_return) {
@@ -119,6 +148,12 @@ void Engine::init_vulkan() {
 	vma_info.instance = instance;
 	vma_info.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
 	vmaCreateAllocator(&vma_info, &vma_allocator);
+	deletion_queue.init(device, vma_allocator);
+
+	pipeline_cache.load(device, vkb_phys_device.properties, "pipeline_cache.bin");
+	if (!pipeline_cache.rejected_reason.empty()) {
+		LOG(1, "Discarded saved pipeline cache: " + pipeline_cache.rejected_reason + ".");
+	}
 }
 
 /*
@@ -129,11 +164,11 @@ void Engine::init_swapchain() {
 }
 
 /*
-allocate draw & depth image
-create their image views
+describe draw & depth image, transient_pool allocates them
 allocate shadowmap & image view
-create & map UBO
+create the per frame upload ring
 create sampler
+register images with the render graph
 */
 void Engine::init_draw_resources() {
 	//Initialize draw image
@@ -148,75 +183,11 @@ void Engine::init_draw_resources() {
 	draw_image.format = VK_FORMAT_R16G16B16A16_SFLOAT;
 	draw_image.extent = draw_img_extent;
 
-	VkImageUsageFlags draw_img_uses = {};
-	draw_img_uses |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-	draw_img_uses |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-	draw_img_uses |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-	VkImageCreateInfo draw_img_info = {};
-	draw_img_info.imageType = VK_IMAGE_TYPE_2D;
-	draw_img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	draw_img_info.pNext = nullptr;
-	draw_img_info.format = draw_image.format;
-	draw_img_info.extent = draw_image.extent;
-	draw_img_info.usage = draw_img_uses;
-	draw_img_info.mipLevels = 1;
-	draw_img_info.arrayLayers = 1;
-	draw_img_info.samples = VK_SAMPLE_COUNT_1_BIT;
-	draw_img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-
-	VmaAllocationCreateInfo draw_img_alloc_info = {};
-	draw_img_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	draw_img_alloc_info.flags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	vmaCreateImage(vma_allocator, &draw_img_info, &draw_img_alloc_info, &draw_image.image, &draw_image.allocation, nullptr);
-
-	VkImageViewCreateInfo draw_view_info = {};
-	draw_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	draw_view_info.pNext = nullptr;
-	draw_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	draw_view_info.image = draw_image.image;
-	draw_view_info.format = draw_image.format;
-	draw_view_info.subresourceRange.baseMipLevel = 0;
-	draw_view_info.subresourceRange.levelCount = 1;
-	draw_view_info.subresourceRange.baseArrayLayer = 0;
-	draw_view_info.subresourceRange.layerCount = 1;
-	draw_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	vkCreateImageView(device, &draw_view_info, nullptr, &draw_image.view);
-
-
-	//Initialize depth image for draw image
+	//Depth image for draw image, both are transient render targets owned by transient_pool
+	//and allocated on the first frame once the render graph knows their lifetimes
 	depth_image.format = VK_FORMAT_D32_SFLOAT;
 	depth_image.extent = draw_img_extent;
 
-	VkImageUsageFlags depth_img_uses = {};
-	depth_img_uses |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-
-	VkImageCreateInfo depth_img_info = {};
-	depth_img_info.imageType = VK_IMAGE_TYPE_2D;
-	depth_img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	depth_img_info.pNext = nullptr;
-	depth_img_info.format = depth_image.format;
-	depth_img_info.extent = depth_image.extent;
-	depth_img_info.usage = depth_img_uses;
-	depth_img_info.mipLevels = 1;
-	depth_img_info.arrayLayers = 1;
-	depth_img_info.samples = VK_SAMPLE_COUNT_1_BIT;
-	depth_img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-	vmaCreateImage(vma_allocator, &depth_img_info, &draw_img_alloc_info, &depth_image.image, &depth_image.allocation, nullptr);
-
-	VkImageViewCreateInfo depth_view_info = {};
-	depth_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	depth_view_info.pNext = nullptr;
-	depth_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	depth_view_info.image = depth_image.image;
-	depth_view_info.format = depth_image.format;
-	depth_view_info.subresourceRange.baseMipLevel = 0;
-	depth_view_info.subresourceRange.levelCount = 1;
-	depth_view_info.subresourceRange.baseArrayLayer = 0;
-	depth_view_info.subresourceRange.layerCount = 1;
-	depth_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	vkCreateImageView(device, &depth_view_info, nullptr, &depth_image.view);
-
 	//Initialize depth image for shadowmap
 	VkExtent3D shadowmap_extent = {};
 	shadowmap_extent.width = 1024;
@@ -225,11 +196,13 @@ void Engine::init_draw_resources() {
 
 	shadowmap_image.format = VK_FORMAT_D32_SFLOAT;
 	shadowmap_image.extent = shadowmap_extent;
+	cascades.resolution = shadowmap_extent.width;
 
 	VkImageUsageFlags shadowmap_usage = {};
 	shadowmap_usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 	shadowmap_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
 	shadowmap_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	shadowmap_usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;		//static cascades copied in from shadow_cache_image
 
 	VkImageCreateInfo shadowmap_img_info = {};
 	shadowmap_img_info.imageType = VK_IMAGE_TYPE_2D;
@@ -239,24 +212,99 @@ void Engine::init_draw_resources() {
 	shadowmap_img_info.extent = shadowmap_image.extent;
 	shadowmap_img_info.usage = shadowmap_usage;
 	shadowmap_img_info.mipLevels = 1;
-	shadowmap_img_info.arrayLayers = 1;
+	shadowmap_img_info.arrayLayers = cascades.count;
 	shadowmap_img_info.samples = VK_SAMPLE_COUNT_1_BIT;
 	shadowmap_img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+
+	VmaAllocationCreateInfo draw_img_alloc_info = {};
+	draw_img_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	draw_img_alloc_info.flags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	vmaCreateImage(vma_allocator, &shadowmap_img_info, &draw_img_alloc_info, &shadowmap_image.image, &shadowmap_image.allocation, nullptr);
 
 	VkImageViewCreateInfo shadowmap_view_info = {};
 	shadowmap_view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 	shadowmap_view_info.pNext = nullptr;
-	shadowmap_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	shadowmap_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;		//rendered as layers & sampled as an array
 	shadowmap_view_info.image = shadowmap_image.image;
 	shadowmap_view_info.format = shadowmap_image.format;
 	shadowmap_view_info.subresourceRange.baseMipLevel = 0;
 	shadowmap_view_info.subresourceRange.levelCount = 1;
 	shadowmap_view_info.subresourceRange.baseArrayLayer = 0;
-	shadowmap_view_info.subresourceRange.layerCount = 1;
+	shadowmap_view_info.subresourceRange.layerCount = cascades.count;
 	shadowmap_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 	vkCreateImageView(device, &shadowmap_view_info, nullptr, &shadowmap_image.view);
 
+	//Static caster depth kept between frames while dynamic casters are drawn over a copy of it
+	shadow_cache_image.format = shadowmap_image.format;
+	shadow_cache_image.extent = shadowmap_image.extent;
+	shadowmap_img_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	vmaCreateImage(vma_allocator, &shadowmap_img_info, &draw_img_alloc_info, &shadow_cache_image.image, &shadow_cache_image.allocation, nullptr);
+	shadowmap_view_info.image = shadow_cache_image.image;
+	vkCreateImageView(device, &shadowmap_view_info, nullptr, &shadow_cache_image.view);
+
+	//EVSM moments, 16 bit floats are filterable, blittable & storable everywhere
+	moments_image.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	moments_image.extent = shadowmap_image.extent;
+	moments_mips = (uint32_t)std::floor(std::log2(std::max(shadowmap_extent.width, shadowmap_extent.height))) + 1;
+
+	VkImageCreateInfo moments_img_info = shadowmap_img_info;
+	moments_img_info.format = moments_image.format;
+	moments_img_info.mipLevels = moments_mips;
+	moments_img_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	vmaCreateImage(vma_allocator, &moments_img_info, &draw_img_alloc_info, &moments_image.image, &moments_image.allocation, nullptr);
+
+	VkImageViewCreateInfo moments_view_info = shadowmap_view_info;
+	moments_view_info.image = moments_image.image;
+	moments_view_info.format = moments_image.format;
+	moments_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	moments_view_info.subresourceRange.levelCount = moments_mips;
+	vkCreateImageView(device, &moments_view_info, nullptr, &moments_image.view);
+	moments_view_info.subresourceRange.levelCount = 1;
+	vkCreateImageView(device, &moments_view_info, nullptr, &moments_storage_view);
+
+	moments_blur_image.format = moments_image.format;
+	moments_blur_image.extent = moments_image.extent;
+	moments_img_info.mipLevels = 1;
+	moments_img_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	vmaCreateImage(vma_allocator, &moments_img_info, &draw_img_alloc_info, &moments_blur_image.image, &moments_blur_image.allocation, nullptr);
+	moments_view_info.image = moments_blur_image.image;
+	vkCreateImageView(device, &moments_view_info, nullptr, &moments_blur_image.view);
+
+	//Spot light shadow atlas, one layer split into a tile per shadowed light
+	atlas_image.format = shadowmap_image.format;
+	atlas_image.extent = VkExtent3D{ shadow_atlas.size, shadow_atlas.size, 1 };
+
+	VkImageCreateInfo atlas_img_info = shadowmap_img_info;
+	atlas_img_info.extent = atlas_image.extent;
+	atlas_img_info.arrayLayers = 1;
+	atlas_img_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	vmaCreateImage(vma_allocator, &atlas_img_info, &draw_img_alloc_info, &atlas_image.image, &atlas_image.allocation, nullptr);
+
+	VkImageViewCreateInfo atlas_view_info = shadowmap_view_info;
+	atlas_view_info.image = atlas_image.image;
+	atlas_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	atlas_view_info.subresourceRange.layerCount = 1;
+	vkCreateImageView(device, &atlas_view_info, nullptr, &atlas_image.view);
+
+	//Point light cube faces, a cube of 6 layers per light, at least one cube so the views are valid without lights
+	uint32_t point_cubes = std::max(std::min(config.point_lights, MAX_POINT_LIGHTS), 1u);
+	point_image.format = shadowmap_image.format;
+	point_image.extent = VkExtent3D{ point_shadows.resolution, point_shadows.resolution, 1 };
+
+	VkImageCreateInfo point_img_info = atlas_img_info;
+	point_img_info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+	point_img_info.extent = point_image.extent;
+	point_img_info.arrayLayers = 6 * point_cubes;
+	vmaCreateImage(vma_allocator, &point_img_info, &draw_img_alloc_info, &point_image.image, &point_image.allocation, nullptr);
+
+	VkImageViewCreateInfo point_view_info = shadowmap_view_info;
+	point_view_info.image = point_image.image;
+	point_view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	point_view_info.subresourceRange.layerCount = 6 * point_cubes;
+	vkCreateImageView(device, &point_view_info, nullptr, &point_image.view);
+	point_view_info.viewType = VK_IMAGE_VIEW_TYPE_CUBE_ARRAY;
+	vkCreateImageView(device, &point_view_info, nullptr, &point_cube_view);
+
 	//Sampler
 	VkSamplerCreateInfo sampler_info = {};
 	sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -276,25 +324,68 @@ void Engine::init_draw_resources() {
 
 	vkCreateSampler(device, &sampler_info, nullptr, &shadowmap_sampler);
 
-	//UBO
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-	VkBufferCreateInfo buffer_info = {};
-	buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buffer_info.pNext = nullptr;
-	buffer_info.size = bufferSize;
-	buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-
-	VmaAllocationCreateInfo allocation_info = {};
-	allocation_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-	allocation_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
-	vmaCreateBuffer(vma_allocator, &buffer_info, &allocation_info, &ubo.buffer, &ubo.allocation, &ubo.info);
+	//Comparison sampler, the linear filter blends the 4 texel compares of a tap
+	sampler_info.compareEnable = VK_TRUE;
+	sampler_info.compareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+	vkCreateSampler(device, &sampler_info, nullptr, &shadowmap_compare_sampler);
+	sampler_info.compareEnable = VK_FALSE;
+
+	//Moments sampler, distant & oblique receivers read prefiltered mips
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+	sampler_info.anisotropyEnable = anisotropy_supported ? VK_TRUE : VK_FALSE;
+	sampler_info.maxAnisotropy = anisotropy_supported ? max_anisotropy : 1.0f;
+	vkCreateSampler(device, &sampler_info, nullptr, &moments_sampler);
+	sampler_info.anisotropyEnable = VK_FALSE;
+	sampler_info.maxAnisotropy = 1.0f;
+	sampler_info.maxLod = 0.0f;
+
+	//Linear clamp sampler for reading the scaled draw image when tonemapping
+	sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	vkCreateSampler(device, &sampler_info, nullptr, &blit_sampler);
+
+	//Render graph resources
+	rg_draw = render_graph.add_resource("draw_image", VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT);
+	rg_depth = render_graph.add_resource("depth_image", VK_NULL_HANDLE, VK_IMAGE_ASPECT_DEPTH_BIT);
+	rg_shadowmap = render_graph.add_resource("shadowmap_image", shadowmap_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	rg_shadow_cache = render_graph.add_resource("shadow_cache_image", shadow_cache_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	rg_moments = render_graph.add_resource("moments_image", moments_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	rg_moments_blur = render_graph.add_resource("moments_blur_image", moments_blur_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	rg_atlas = render_graph.add_resource("atlas_image", atlas_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	rg_point = render_graph.add_resource("point_image", point_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	rg_swapchain = render_graph.add_resource("swapchain", VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	//Per frame ring, a slice per frame in flight holding the UBO then instance transforms
+	ring_instance_offset = FrameRing::align_up(sizeof(UniformBufferObject), 16);
+	VkDeviceSize slice_size = FrameRing::align_up(ring_instance_offset + 1024 * sizeof(glm::mat4), uniform_alignment);
+	frame_ring.create(device, vma_allocator, frames_in_flight, slice_size);
+
+	//Depth bounds readback, a pair of uints per frame in flight, read on the CPU after the frame's fence
+	VkBufferCreateInfo bounds_info = {};
+	bounds_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bounds_info.pNext = nullptr;
+	bounds_info.size = sizeof(DepthBounds);
+	bounds_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	VmaAllocationCreateInfo bounds_alloc_info = {};
+	bounds_alloc_info.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+	bounds_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+	for (PerFrameData& frame : frames) {
+		BufferData& bounds = frame.depth_bounds_buffer;
+		VK_CHECK(vmaCreateBuffer(vma_allocator, &bounds_info, &bounds_alloc_info, &bounds.buffer, &bounds.allocation, &bounds.info));
+		frame.depth_bounds_pending = false;
+	}
 }
 
 /*
 pools and buffers
 */
 void Engine::init_commands() {
-	frames.resize(FRAMES_IN_FLIGHT);
+	frames.resize(frames_in_flight);
 
 	VkCommandPoolCreateInfo command_pool_info = {};
 	command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -302,7 +393,10 @@ void Engine::init_commands() {
 	command_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 	command_pool_info.queueFamilyIndex = graphics_queue_family;
 
-	for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+	for (uint32_t i = 0; i < frames_in_flight; i++) {
+		frames[i].awaiting_completion = false;
+		frames[i].shaded_shadow_mode = SHADOW_MODE_COUNT;
+		frames[i].shadow_draws = 0;
 		vkCreateCommandPool(device, &command_pool_info, nullptr, &frames[i].command_pool);
 
 		VkCommandBufferAllocateInfo cmd_alloc_info = {};
@@ -320,6 +414,46 @@ void Engine::init_commands() {
 	command_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 	command_pool_info.queueFamilyIndex = transfer_queue_family;
 	vkCreateCommandPool(device, &command_pool_info, nullptr, &single_time_pool);
+
+	//worker pools for parallel recording, reset as a whole every frame
+	uint32_t hardware_threads = std::thread::hardware_concurrency();
+	worker_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+	workers.init(worker_count);
+
+	VkCommandPoolCreateInfo worker_pool_info = {};
+	worker_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	worker_pool_info.pNext = nullptr;
+	worker_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	worker_pool_info.queueFamilyIndex = graphics_queue_family;
+
+	for (uint32_t i = 0; i < frames_in_flight; i++) {
+		frames[i].worker_pools.resize(worker_count);
+		frames[i].worker_shadow_cmds.resize(worker_count);
+		frames[i].worker_shadow_dynamic_cmds.resize(worker_count);
+		frames[i].worker_atlas_cmds.resize(worker_count);
+		frames[i].worker_point_cmds.resize(worker_count);
+		frames[i].worker_prepass_cmds.resize(worker_count);
+		frames[i].worker_geo_cmds.resize(worker_count);
+
+		for (uint32_t w = 0; w < worker_count; w++) {
+			vkCreateCommandPool(device, &worker_pool_info, nullptr, &frames[i].worker_pools[w]);
+
+			VkCommandBufferAllocateInfo cmd_alloc_info = {};
+			cmd_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			cmd_alloc_info.pNext = nullptr;
+			cmd_alloc_info.commandPool = frames[i].worker_pools[w];
+			cmd_alloc_info.commandBufferCount = 1;
+			cmd_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+			vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].worker_shadow_cmds[w]);
+			vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].worker_shadow_dynamic_cmds[w]);
+			vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].worker_atlas_cmds[w]);
+			vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].worker_point_cmds[w]);
+			vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].worker_prepass_cmds[w]);
+			vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].worker_geo_cmds[w]);
+		}
+	}
+	LOG(2, "Created command pools for " + std::to_string(worker_count) + " recording workers.");
 }
 
 /*
@@ -336,7 +470,7 @@ void Engine::init_sync_structures() {
 	semaphore_info.pNext = nullptr;
 	semaphore_info.flags = 0;
 
-	for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+	for (uint32_t i = 0; i < frames_in_flight; i++) {
 		vkCreateFence(device, &fence_info, nullptr, &frames[i].render_fence);
 
 		vkCreateSemaphore(device, &semaphore_info, nullptr, &frames[i].render_semaphore);
@@ -344,32 +478,108 @@ void Engine::init_sync_structures() {
 	}
 }
 
+/*
+timestamp & pipeline statistics pools per frame
+*/
+void Engine::init_queries() {
+	profiler.init(device, frames_in_flight, timestamp_period, pipeline_statistics_supported);
+	if (!pipeline_statistics_supported) {
+		LOG(2, "Pipeline statistics queries unsupported, fragment invocations will not be reported.");
+	}
+}
+
 /*
 sets default values for ubo
 */
 void Engine::init_ubo_data() {
 	ubo_data = {};
-	ubo_data.view = glm::lookAt(glm::vec3(0.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	ubo_data.proj = glm::perspectiveFovZO(glm::radians(70.0f), 1600.0f, 900.0f, 5.0f, 0.5f);
+	camera = {};
+	camera.pos = glm::vec3(0.0f, 2.0f, 2.0f);
+	camera.yaw = -90.0f;
+	camera.pitch = -45.0f;
+	camera.speed = 3.0f;
+	camera.sensitivity = 0.1f;
+	camera.fov = 70.0f;
+	camera.aspect = 1600.0f / 900.0f;
+	camera.near_plane = 0.5f;
+	camera.far_plane = 5.0f;
+	last_animation_update = std::chrono::high_resolution_clock::now();
+	ubo_data.view = glm::lookAt(camera.pos, camera.pos + camera.forward(), glm::vec3(0.0f, 1.0f, 0.0f));
+	ubo_data.eye_pos = camera.pos;
+	//reversed Z, near & far swapped
+	ubo_data.proj = glm::perspectiveZO(glm::radians(camera.fov), camera.aspect, camera.far_plane, camera.near_plane);
 	ubo_data.proj[1][1] *= -1;
 	ubo_data.Q = glm::mat4(1);
 
 	sun.pos = glm::vec3(0.0f, 5.0f, 1.0f);
 	sun.col = glm::vec3(1.0f, 1.0f, 1.0f);
 
-	//light info
-	ubo_data.lightpos = sun.pos;
+	//light info, the cascades are fit to the camera in update_uniform_buffer
+	ubo_data.light_dir = glm::normalize(sun.pos);
 	ubo_data.lightcol = sun.col;
-	ubo_data.light_view = glm::lookAt(sun.pos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	ubo_data.light_proj = glm::perspectiveFovZO(glm::radians(90.0f), 1024.0f, 1024.0f, 5.0f, 0.5f);
-	ubo_data.light_proj[1][1] *= -1;
 
 	//temp hardcoded material 
 	ubo_data.ka = glm::vec3(0.2f, 0.2f, 0.2f);
 	ubo_data.kd = glm::vec3(0.5f, 0.2f, 0.2f);
 	ubo_data.kss = glm::vec4(1.0f, 1.0f, 1.0f, 10.0f);
+	last_camera_update = std::chrono::high_resolution_clock::now();
+}
 
-	memcpy(ubo.info.pMappedData, &ubo_data, sizeof(UniformBufferObject));
+/*
+demo ring of coloured spot lights above the scene, each aimed down and inward
+they never move, so each one's projection is built once here, tiles are assigned in update_spot_lights
+*/
+void Engine::init_spot_lights(uint32_t count) {
+	spot_lights.clear();
+	count = std::min(count, MAX_SPOT_LIGHTS);
+	for (uint32_t i = 0; i < count; i++) {
+		float angle = 6.2831853f * i / count;
+		glm::vec3 ring = glm::vec3(std::cos(angle), 0.0f, std::sin(angle));
+
+		SpotLight light = {};
+		light.pos = ring * 1.5f + glm::vec3(0.0f, 1.5f, 0.0f);
+		light.dir = glm::normalize(ring * 0.5f - light.pos);
+		light.col = 0.15f * glm::vec3(0.5f + 0.5f * std::cos(angle), 0.5f + 0.5f * std::cos(angle + 2.094f), 0.5f + 0.5f * std::cos(angle + 4.189f));
+		light.range = 4.0f;
+		light.inner_angle = 20.0f;
+		light.outer_angle = 30.0f;
+
+		//reversed Z like the camera, near & far swapped
+		glm::vec3 up = std::abs(light.dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::mat4 light_proj = glm::perspectiveZO(glm::radians(2.0f * light.outer_angle), 1.0f, light.range, 0.05f);
+		light_proj[1][1] *= -1;
+		light.view_proj = light_proj * glm::lookAt(light.pos, light.pos + light.dir, up);
+		spot_lights.push_back(light);
+	}
+	LOG(2, "Created " + std::to_string(spot_lights.size()) + " spot lights sharing a " + std::to_string(shadow_atlas.size) + "px shadow atlas.");
+}
+
+/*
+demo point lights beside the bunny & the teapot, static so their faces & UBO entries are built once here
+point_image holds a cube per light of config.point_lights, count can't be more
+*/
+void Engine::init_point_lights(uint32_t count) {
+	const glm::vec3 positions[MAX_POINT_LIGHTS] = { { 0.7f, 0.8f, 0.5f }, { 2.0f, 1.0f, -0.8f }, { -2.0f, 0.8f, 0.6f }, { 0.0f, 1.2f, -1.5f } };
+	point_lights.clear();
+	count = std::min(count, MAX_POINT_LIGHTS);
+	for (uint32_t i = 0; i < count; i++) {
+		PointLight light = {};
+		light.pos = positions[i];
+		light.col = glm::vec3(0.6f, 0.45f, 0.3f);
+		light.range = 3.0f;
+		point_shadows.fit(light);
+		point_lights.push_back(light);
+
+		PointLightData& data = ubo_data.point_lights[i];
+		for (uint32_t f = 0; f < 6; f++) {
+			data.face_view_proj[f] = light.face_view_proj[f];
+		}
+		data.position_range = glm::vec4(light.pos, light.range);
+		data.color = glm::vec4(light.col, 0.0f);
+	}
+	ubo_data.point_params = glm::vec4((float)count, 1.0f / point_shadows.resolution, 0.0f, 0.0f);
+	point_light_version++;
+	LOG(2, "Created " + std::to_string(point_lights.size()) + " point lights with " + std::to_string(point_shadows.resolution) + "px cube shadows.");
 }
 
 /*
@@ -377,88 +587,297 @@ descriptor writes
 */
 void Engine::init_descriptors() {
 
+	//room for a global set per frame in flight plus the current one, frame_ring growth swaps sets
+	//instead of rewriting one the GPU may still be reading
+	uint32_t global_sets = frames_in_flight + 1;
 	std::vector<VkDescriptorPoolSize> pool_sizes = {
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-		{VK_DESCRIPTOR_TYPE_SAMPLER, 1},
-		{VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1}
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, global_sets},
+		{VK_DESCRIPTOR_TYPE_SAMPLER, global_sets * 3},
+		{VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, global_sets * 4},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6 + frames_in_flight},
+		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 6},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames_in_flight}
 	};
 	descriptor_builder.init_pool(device, pool_sizes);
 
-	descriptor_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS);
-	descriptor_builder.add_binding(1, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	descriptor_builder.add_binding(2, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
-
-	descriptor_builder.create_layout(device, &global_layout);
-	descriptor_builder.allocate_set(device, global_layout, &global_set);
-
-	//Ubo
-	VkDescriptorBufferInfo buffer_info = {};
-	buffer_info.buffer = ubo.buffer;
-	buffer_info.offset = 0;
-	buffer_info.range = sizeof(UniformBufferObject);
+	if (descriptor_buffer_enabled) {
+		//no dynamic offsets with descriptor buffers, each frame's copy points its UBO at its own ring slice
+		descriptor_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_ALL_GRAPHICS);
+		descriptor_builder.add_binding(1, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(2, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(3, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(4, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(5, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(6, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(7, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.create_layout(device, &global_layout, VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT);
+		descriptor_buffer.create(device, vma_allocator, global_layout, frames_in_flight);
+	}
+	else {
+		descriptor_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_ALL_GRAPHICS);
+		descriptor_builder.add_binding(1, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(2, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(3, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(4, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(5, VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(6, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.add_binding(7, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT);
+		descriptor_builder.create_layout(device, &global_layout);
+		descriptor_builder.allocate_set(device, global_layout, &global_set);
+		write_global_set(global_set);
+	}
 
-	VkWriteDescriptorSet ubo_write = {};
-	ubo_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	ubo_write.pNext = nullptr;
-	ubo_write.dstBinding = 0;
-	ubo_write.dstSet = global_set;
-	ubo_write.descriptorCount = 1;
-	ubo_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	ubo_write.pBufferInfo = &buffer_info;
+	//Tonemap, a set per frame in flight written after its fence in write_tonemap_set
+	descriptor_builder.clear_bindings();
+	descriptor_builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+	descriptor_builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+	descriptor_builder.create_layout(device, &tonemap_set_layout);
+	tonemap_sets.resize(frames_in_flight);
+	for (VkDescriptorSet& set : tonemap_sets) {
+		descriptor_builder.allocate_set(device, tonemap_set_layout, &set);
+	}
 
-	//Sampler
-	VkDescriptorImageInfo sampler_info = {};
-	sampler_info.sampler = shadowmap_sampler;
-
-	VkWriteDescriptorSet sampler_write = {};
-	sampler_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	sampler_write.pNext = nullptr;
-	sampler_write.dstBinding = 1;
-	sampler_write.dstSet = global_set;
-	sampler_write.descriptorCount = 1;
-	sampler_write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-	sampler_write.pImageInfo = &sampler_info;
-
-	//SampledImage
-	VkDescriptorImageInfo sampled_img_info = {};
-	sampled_img_info.imageView = shadowmap_image.view;
-	sampled_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-	VkWriteDescriptorSet sampled_img_write = {};
-	sampled_img_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	sampled_img_write.pNext = nullptr;
-	sampled_img_write.dstBinding = 2;
-	sampled_img_write.dstSet = global_set;
-	sampled_img_write.descriptorCount = 1;
-	sampled_img_write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-	sampled_img_write.pImageInfo = &sampled_img_info;
-
-	VkWriteDescriptorSet write_sets[] = { ubo_write, sampler_write, sampled_img_write };
-	vkUpdateDescriptorSets(device, 3, write_sets, 0, nullptr);
+	//Depth reduction, a set per frame in flight pointing at its readback buffer & this frame's depth_image
+	descriptor_builder.clear_bindings();
+	descriptor_builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+	descriptor_builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+	descriptor_builder.create_layout(device, &depth_reduce_set_layout);
+	depth_reduce_sets.resize(frames_in_flight);
+	for (VkDescriptorSet& set : depth_reduce_sets) {
+		descriptor_builder.allocate_set(device, depth_reduce_set_layout, &set);
+	}
 
+	//Moment blur, shadow map depth -> moments_blur_image -> moments_image mip 0
+	descriptor_builder.clear_bindings();
+	descriptor_builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+	descriptor_builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+	descriptor_builder.create_layout(device, &moments_set_layout);
+
+	VkImageView blur_src[2] = { shadowmap_image.view, moments_blur_image.view };
+	VkImageView blur_dst[2] = { moments_blur_image.view, moments_storage_view };
+	for (uint32_t axis = 0; axis < 2; axis++) {
+		descriptor_builder.allocate_set(device, moments_set_layout, &moments_sets[axis]);
+
+		VkDescriptorImageInfo src_info = {};
+		src_info.sampler = shadowmap_sampler;
+		src_info.imageView = blur_src[axis];
+		src_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkDescriptorImageInfo dst_info = {};
+		dst_info.imageView = blur_dst[axis];
+		dst_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet writes[2] = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].pNext = nullptr;
+		writes[0].dstBinding = 0;
+		writes[0].dstSet = moments_sets[axis];
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &src_info;
+
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].pNext = nullptr;
+		writes[1].dstBinding = 1;
+		writes[1].dstSet = moments_sets[axis];
+		writes[1].descriptorCount = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[1].pImageInfo = &dst_info;
+		vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+	}
 }
 
 //Pipelines
+/*
+layouts are created here, the pipelines compile concurrently on the compile pool sharing pipeline_cache
+init only waits for the ones the first frame draws with, the rest are picked up by update_pipelines
+*/
 void Engine::init_pipelines() {
+	auto start = std::chrono::high_resolution_clock::now();
+	//half the recording workers, a variant compiling mid run leaves cores for the frame
+	compile_workers.init(std::max(worker_count / 2, 1u));
 	init_mesh_pipeline();
 	init_shadow_pipeline();
+	init_depth_prepass_pipeline();
+	init_tonemap_pipeline();
+	init_moments_pipeline();
+	init_depth_reduce_pipeline();
+
+	pipeline_table.assign(PIPELINE_ID_COUNT, { VK_NULL_HANDLE, VK_NULL_HANDLE });
+	update_pipelines();
+	pipeline_create_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	LOG(1, "Created first frame pipelines in " + std::to_string(pipeline_create_ms) + "ms, "
+		+ (pipeline_cache.warm ? "warm cache (" + std::to_string(pipeline_cache.loaded_bytes / 1024) + "KB)" : std::string("cold cache")));
 }
+
 /*
-creates mesh pipeline & layout
+registry entry for desc, a miss queues its compile on the compile pool
 */
-void Engine::init_mesh_pipeline() {
-	VkShaderModule vert_shader;
-	if (!load_shader(device, &vert_shader, shader_paths.mesh_vert)) {
-		logger.err("Failed to create mesh vertex shader.");
+PipelineEntry& Engine::request_pipeline(const PipelineDesc& desc) {
+	size_t key = pipeline_registry.hash_desc(desc);
+	PipelineEntry* entry = pipeline_registry.find(key, desc);
+	if (entry != nullptr) {
+		return *entry;
 	}
-	LOG(3, "Loaded mesh vertex shader.");
+	entry = &pipeline_registry.insert(key, desc);
+	entry->done = compile_workers.submit([this, entry]() {
+		auto start = std::chrono::high_resolution_clock::now();
+		entry->pipeline = compile_pipeline(entry->desc);
+		entry->compile_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	});
+	return *entry;
+}
+
+/*
+the pipeline for desc once compiled, fallback while it's still compiling
+first frame pipelines without a fallback block, nothing could be drawn in their place
+*/
+VkPipeline Engine::get_pipeline(const PipelineDesc& desc, VkPipeline fallback) {
+	PipelineEntry& entry = request_pipeline(desc);
+	if (!entry.ready && desc.first_frame && fallback == VK_NULL_HANDLE) {
+		entry.done.wait();
+		poll_pipelines();
+	}
+	if (entry.ready) {
+		return entry.pipeline;
+	}
+	pipeline_registry.fallbacks++;
+	return fallback;
+}
 
+/*
+this frame's pipelines, a variant that is still compiling keeps the previous pipeline of its slot
+only resolved again when the variant or cull state changed or a compile finished since
+*/
+void Engine::update_pipelines() {
+	uint64_t state = mesh_shading.key() * 2 + (two_sided ? 1 : 0);
+	if (state != pipeline_state) {
+		pipeline_state = state;
+		pipelines_stale = true;
+	}
+	if (!pipelines_stale) {
+		return;
+	}
+	//cleared first, a compile finishing while this resolves marks it again
+	pipelines_stale = false;
+
+	PipelineDesc mesh = mesh_desc;
+	PipelineDesc mesh_equal = mesh_equal_desc;
+	PipelineDesc depth_prepass = depth_prepass_desc;
+	if (two_sided) {
+		mesh.cull_mode = VK_CULL_MODE_NONE;
+		mesh_equal.cull_mode = VK_CULL_MODE_NONE;
+		depth_prepass.cull_mode = VK_CULL_MODE_NONE;
+	}
+	mesh_shading.specialize(mesh, VK_SHADER_STAGE_FRAGMENT_BIT);
+	mesh_shading.specialize(mesh_equal, VK_SHADER_STAGE_FRAGMENT_BIT);
+	uint64_t fallbacks = pipeline_registry.fallbacks;
+	pipeline_table[MESH_PIPELINE_ID] = { get_pipeline(mesh, pipeline_table[MESH_PIPELINE_ID].pipeline), mesh_pipeline_layout };
+	pipeline_table[MESH_EQUAL_PIPELINE_ID] = { get_pipeline(mesh_equal, pipeline_table[MESH_EQUAL_PIPELINE_ID].pipeline), mesh_pipeline_layout };
+	//while the new variant compiles the fallback still shades with the previous mode
+	if (pipeline_registry.fallbacks == fallbacks) {
+		shaded_shadow_mode = mesh_shading.options.shadow_mode;
+	}
+	pipeline_table[SHADOW_PIPELINE_ID] = { get_pipeline(shadow_desc, pipeline_table[SHADOW_PIPELINE_ID].pipeline), shadow_pipeline_layout };
+	pipeline_table[POINT_SHADOW_PIPELINE_ID] = { get_pipeline(point_shadow_desc, pipeline_table[POINT_SHADOW_PIPELINE_ID].pipeline), shadow_pipeline_layout };
+	pipeline_table[DEPTH_PREPASS_PIPELINE_ID] = { get_pipeline(depth_prepass, pipeline_table[DEPTH_PREPASS_PIPELINE_ID].pipeline), mesh_pipeline_layout };
+	tonemap_pipeline = get_pipeline(tonemap_desc, tonemap_pipeline);
+	moments_pipeline = get_pipeline(moments_desc, moments_pipeline);
+	depth_reduce_pipeline = get_pipeline(depth_reduce_desc, depth_reduce_pipeline);
+}
+
+/*
+runs on a compile worker, loads its own shader modules so nothing but the pipeline cache is shared
+*/
+VkPipeline Engine::compile_pipeline(const PipelineDesc& desc) {
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	VkSpecializationInfo spec_info = {};
+	spec_info.mapEntryCount = (uint32_t)desc.spec_entries.size();
+	spec_info.pMapEntries = desc.spec_entries.data();
+	spec_info.dataSize = desc.spec_data.size();
+	spec_info.pData = desc.spec_data.data();
+	const VkSpecializationInfo* specialization = desc.spec_data.empty() ? nullptr : &spec_info;
+
+	if (desc.comp_path != nullptr) {
+		VkShaderModule comp_shader;
+		if (!load_shader(device, &comp_shader, desc.comp_path)) {
+			logger.err("Failed to create " + desc.name + " compute shader.");
+		}
+
+		VkPipelineShaderStageCreateInfo stage_info = {};
+		stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage_info.pNext = nullptr;
+		stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		stage_info.module = comp_shader;
+		stage_info.pName = "main";
+		stage_info.pSpecializationInfo = specialization;
+
+		VkComputePipelineCreateInfo pipeline_info = {};
+		pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipeline_info.pNext = nullptr;
+		pipeline_info.stage = stage_info;
+		pipeline_info.layout = desc.layout;
+		pipeline_info.flags = desc.flags;
+		VK_CHECK(vkCreateComputePipelines(device, pipeline_cache.cache, 1, &pipeline_info, nullptr, &pipeline));
+
+		vkDestroyShaderModule(device, comp_shader, nullptr);
+		return pipeline;
+	}
+
+	VkShaderModule vert_shader;
+	if (!load_shader(device, &vert_shader, desc.vert_path)) {
+		logger.err("Failed to create " + desc.name + " vertex shader.");
+	}
 	VkShaderModule frag_shader;
-	if (!load_shader(device, &frag_shader, shader_paths.mesh_frag)) {
-		logger.err("Failed to create mesh fragment shader.");
+	if (!load_shader(device, &frag_shader, desc.frag_path)) {
+		//err throws, the vertex module would leak
+		vkDestroyShaderModule(device, vert_shader, nullptr);
+		logger.err("Failed to create " + desc.name + " fragment shader.");
 	}
-	LOG(3, "Loaded mesh fragment shader.");
 
+	PipelineBuilder builder;
+	builder.set_shaders(vert_shader, frag_shader,
+		desc.spec_stage == VK_SHADER_STAGE_VERTEX_BIT ? specialization : nullptr,
+		desc.spec_stage == VK_SHADER_STAGE_FRAGMENT_BIT ? specialization : nullptr);
+	builder.set_state(desc);
+	pipeline = builder.build_pipeline(device, pipeline_cache.cache);
+
+	vkDestroyShaderModule(device, vert_shader, nullptr);
+	vkDestroyShaderModule(device, frag_shader, nullptr);
+	if (pipeline == VK_NULL_HANDLE) {
+		logger.err("Failed to create " + desc.name + " pipeline.");
+	}
+	return pipeline;
+}
+
+/*
+logs pipelines that finished compiling, rethrows compile errors on the main thread
+*/
+void Engine::poll_pipelines() {
+	for (PipelineEntry* entry : pipeline_registry.poll()) {
+		LOG(2, "Compiled " + entry->desc.name + " pipeline in " + std::to_string(entry->compile_ms) + "ms.");
+		pipelines_stale = true;
+	}
+}
+
+/*
+destroys variants unbound for pipeline_evict_frames, e.g. a cull or shading mode toggled away from
+frames in flight may still have them recorded, so they go through the deletion queue
+*/
+void Engine::evict_pipelines() {
+	std::vector<VkPipeline> bound = { tonemap_pipeline, moments_pipeline, depth_reduce_pipeline };
+	for (const PipelineBinding& binding : pipeline_table) {
+		bound.push_back(binding.pipeline);
+	}
+	for (VkPipeline pipeline : pipeline_registry.evict(frame_counter, pipeline_evict_frames, bound)) {
+		deletion_queue.push_pipeline(frame_counter, pipeline);
+	}
+}
+
+/*
+creates mesh layout, requests the mesh & mesh equal pipelines
+*/
+void Engine::init_mesh_pipeline() {
 	VkPushConstantRange pc_range = {};
 	pc_range.offset = 0;
 	pc_range.size = sizeof(PushConstants);
@@ -475,40 +894,29 @@ void Engine::init_mesh_pipeline() {
 
 	VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr, &mesh_pipeline_layout));
 
-	pipeline_builder.clear();
-	pipeline_builder.pipeline_layout = mesh_pipeline_layout;
-	pipeline_builder.set_shaders(vert_shader, frag_shader);
-	pipeline_builder.set_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
-	pipeline_builder.set_culling_mode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
-	pipeline_builder.set_multisampling_none();
-	pipeline_builder.disable_blending();
-	pipeline_builder.enable_depthtest(VK_TRUE, VK_COMPARE_OP_GREATER_OR_EQUAL);
-	//pipeline_builder.disable_depthtest();
-	pipeline_builder.set_color_attachment_format(draw_image.format);
-	pipeline_builder.set_depth_attachment_format(depth_image.format);
-	mesh_pipeline = pipeline_builder.build_pipeline(device);
-
-	vkDestroyShaderModule(device, vert_shader, nullptr);
-	vkDestroyShaderModule(device, frag_shader, nullptr);
+	mesh_desc = {};
+	mesh_desc.name = "mesh";
+	mesh_desc.vert_path = shader_paths.mesh_vert;
+	mesh_desc.frag_path = shader_paths.mesh_frag;
+	mesh_desc.layout = mesh_pipeline_layout;
+	mesh_desc.flags = descriptor_buffer_enabled ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+	mesh_desc.color_format = draw_image.format;
+	mesh_desc.depth_format = depth_image.format;
+	request_pipeline(mesh_desc);
+
+	//depth is already resolved by the pre-pass, only the visible surface is shaded
+	mesh_equal_desc = mesh_desc;
+	mesh_equal_desc.name = "mesh_equal";
+	mesh_equal_desc.depth_write = VK_FALSE;
+	mesh_equal_desc.depth_op = VK_COMPARE_OP_EQUAL;
+	mesh_equal_desc.first_frame = false;
+	request_pipeline(mesh_equal_desc);
 }
 
 /*
-
+creates shadow layout, requests the shadow pipeline
 */
 void Engine::init_shadow_pipeline() {
-	VkShaderModule vert_shader;
-	if (!load_shader(device, &vert_shader, shader_paths.shadow_vert)) {
-		logger.err("Failed to create shadow vertex shader.");
-	}
-	LOG(3, "Loaded mesh vertex shader.");
-
-	VkShaderModule frag_shader;
-	if (!load_shader(device, &frag_shader, shader_paths.shadow_frag)) {
-		logger.err("Failed to create shadow fragment shader.");
-	}
-	LOG(3, "Loaded mesh fragment shader.");
-
 	VkPushConstantRange pc_range = {};
 	pc_range.offset = 0;
 	pc_range.size = sizeof(PushConstants);
@@ -524,23 +932,117 @@ void Engine::init_shadow_pipeline() {
 	layout_info.pPushConstantRanges = &pc_range;
 
 	VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr, &shadow_pipeline_layout));
-	
-	pipeline_builder.clear();
-	pipeline_builder.pipeline_layout = shadow_pipeline_layout;
-	pipeline_builder.set_shaders(vert_shader, frag_shader);
-	pipeline_builder.set_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
-	pipeline_builder.set_culling_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
-	pipeline_builder.set_multisampling_none();
-	pipeline_builder.disable_blending();
-	pipeline_builder.enable_depthtest(VK_TRUE, VK_COMPARE_OP_GREATER_OR_EQUAL);
-	//pipeline_builder.disable_depthtest();
-	//pipeline_builder.set_color_attachment_format(draw_image.format);
-	pipeline_builder.set_depth_attachment_format(shadowmap_image.format);
-	shadow_pipeline = pipeline_builder.build_pipeline(device);
 
-	vkDestroyShaderModule(device, vert_shader, nullptr);
-	vkDestroyShaderModule(device, frag_shader, nullptr);
+	shadow_desc = {};
+	shadow_desc.name = "shadow";
+	shadow_desc.vert_path = shader_paths.shadow_vert;
+	shadow_desc.frag_path = shader_paths.shadow_frag;
+	shadow_desc.layout = shadow_pipeline_layout;
+	shadow_desc.flags = descriptor_buffer_enabled ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+	shadow_desc.cull_mode = VK_CULL_MODE_NONE;
+	shadow_desc.depth_format = shadowmap_image.format;
+	request_pipeline(shadow_desc);
+
+	//writing gl_FragDepth turns off early depth testing for the point faces only
+	//no rasterizer depth bias is copied over, the shadow pipelines have none, the receiver adds DEPTH_BIAS in mesh.frag's compare
+	point_shadow_desc = shadow_desc;
+	point_shadow_desc.name = "point_shadow";
+	point_shadow_desc.frag_path = shader_paths.point_shadow_frag;
+	point_shadow_desc.depth_format = point_image.format;
+	request_pipeline(point_shadow_desc);
+}
+
+/*
+position only pipeline writing depth_image with the camera matrices, shares the mesh layout
+only used once the pre-pass is toggled on, so the first frame doesn't wait for it
+*/
+void Engine::init_depth_prepass_pipeline() {
+	depth_prepass_desc = {};
+	depth_prepass_desc.name = "depth_prepass";
+	depth_prepass_desc.vert_path = shader_paths.depth_vert;
+	depth_prepass_desc.frag_path = shader_paths.shadow_frag;
+	depth_prepass_desc.layout = mesh_pipeline_layout;
+	depth_prepass_desc.flags = descriptor_buffer_enabled ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+	depth_prepass_desc.depth_format = depth_image.format;
+	depth_prepass_desc.first_frame = false;
+	request_pipeline(depth_prepass_desc);
+}
+
+/*
+compute pipeline tonemapping draw_image into a swapchain storage image
+*/
+void Engine::init_tonemap_pipeline() {
+	VkPushConstantRange pc_range = {};
+	pc_range.offset = 0;
+	pc_range.size = sizeof(TonemapPushConstants);
+	pc_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.pNext = nullptr;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &tonemap_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &pc_range;
+	VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr, &tonemap_pipeline_layout));
+
+	tonemap_desc = {};
+	tonemap_desc.name = "tonemap";
+	tonemap_desc.comp_path = shader_paths.tonemap_comp;
+	tonemap_desc.layout = tonemap_pipeline_layout;
+	request_pipeline(tonemap_desc);
+}
+
+/*
+compute pipeline warping shadow map depth into EVSM moments and blurring them, one axis per dispatch
+*/
+void Engine::init_moments_pipeline() {
+	VkPushConstantRange pc_range = {};
+	pc_range.offset = 0;
+	pc_range.size = sizeof(MomentsPushConstants);
+	pc_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.pNext = nullptr;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &moments_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &pc_range;
+	VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr, &moments_pipeline_layout));
+
+	moments_desc = {};
+	moments_desc.name = "moments_blur";
+	moments_desc.comp_path = shader_paths.moments_blur_comp;
+	moments_desc.layout = moments_pipeline_layout;
+	request_pipeline(moments_desc);
+}
+
+/*
+compute pipeline reducing depth_image to the min & max visible view depth for sample_distribution
+not needed to draw, so the first frames go without it until it has compiled
+*/
+void Engine::init_depth_reduce_pipeline() {
+	VkPushConstantRange pc_range = {};
+	pc_range.offset = 0;
+	pc_range.size = sizeof(DepthReducePushConstants);
+	pc_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo layout_info = {};
+	layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout_info.pNext = nullptr;
+	layout_info.setLayoutCount = 1;
+	layout_info.pSetLayouts = &depth_reduce_set_layout;
+	layout_info.pushConstantRangeCount = 1;
+	layout_info.pPushConstantRanges = &pc_range;
+	VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr, &depth_reduce_pipeline_layout));
+
+	depth_reduce_desc = {};
+	depth_reduce_desc.name = "depth_reduce";
+	depth_reduce_desc.comp_path = shader_paths.depth_reduce_comp;
+	depth_reduce_desc.layout = depth_reduce_pipeline_layout;
+	depth_reduce_desc.first_frame = false;
+	request_pipeline(depth_reduce_desc);
 }
 
 
@@ -1,7 +1,49 @@
 #include "engine.h"
 
 //Swapchain
-void Engine::create_swapchain(uint32_t width, uint32_t height) {
+void Engine::create_swapchain(uint32_t width, uint32_t height, VkSwapchainKHR old_swapchain) {
+	//requested present mode if the surface has it, FIFO is always available
+	uint32_t mode_count = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(phys_device, surface, &mode_count, nullptr);
+	std::vector<VkPresentModeKHR> modes(mode_count);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(phys_device, surface, &mode_count, modes.data());
+	present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	if (std::find(modes.begin(), modes.end(), config.present_mode) != modes.end()) {
+		present_mode = config.present_mode;
+	}
+	else {
+		LOG(1, std::string(string_VkPresentModeKHR(config.present_mode)) + " unsupported by the surface, using FIFO");
+	}
+
+	//one image on screen plus one per frame in flight so acquire doesn't throttle the CPU below
+	//frames_in_flight, mailbox wants a spare to swap into, vkb clamps to the surface limits
+	uint32_t image_count = frames_in_flight + 1;
+	if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
+		image_count = std::max(image_count, 3u);
+	}
+
+	//storage usage lets the tonemap pass write the swapchain directly, needs the surface to allow it and
+	//the rgba8 format the shader declares to be the one picked
+	VkSurfaceCapabilitiesKHR surface_caps = {};
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(phys_device, surface, &surface_caps);
+	uint32_t format_count = 0;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(phys_device, surface, &format_count, nullptr);
+	std::vector<VkSurfaceFormatKHR> formats(format_count);
+	vkGetPhysicalDeviceSurfaceFormatsKHR(phys_device, surface, &format_count, formats.data());
+	bool rgba8_available = std::any_of(formats.begin(), formats.end(), [](const VkSurfaceFormatKHR& f) {
+		return f.format == VK_FORMAT_R8G8B8A8_UNORM && f.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	});
+	VkFormatProperties format_props = {};
+	vkGetPhysicalDeviceFormatProperties(phys_device, VK_FORMAT_R8G8B8A8_UNORM, &format_props);
+	compute_present_supported = rgba8_available
+		&& (surface_caps.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT)
+		&& (format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+
+	VkImageUsageFlags swapchain_usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if (compute_present_supported) {
+		swapchain_usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+	}
+
 	vkb::SwapchainBuilder swapchain_builder{ phys_device, device, surface };
 	vkb::Result<vkb::Swapchain> vkb_swapchain_res = swapchain_builder
 		.set_desired_format(
@@ -9,9 +51,11 @@ void Engine::create_swapchain(uint32_t width, uint32_t height) {
 			.format = VK_FORMAT_R8G8B8A8_UNORM,
 			.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
 			})
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+		.set_desired_present_mode(present_mode)
+		.set_desired_min_image_count(image_count)
 		.set_desired_extent(width, height)
-		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+		.add_image_usage_flags(swapchain_usage)
+		.set_old_swapchain(old_swapchain)
 		.build();
 
 	if (!vkb_swapchain_res) {
@@ -20,10 +64,12 @@ void Engine::create_swapchain(uint32_t width, uint32_t height) {
 	vkb::Swapchain vkb_swapchain = vkb_swapchain_res.value();
 
 	swapchain_extent = vkb_swapchain.extent;
+	swapchain_image_format = vkb_swapchain.image_format;
 	swapchain = vkb_swapchain.swapchain;
 	swapchain_images = vkb_swapchain.get_images().value();
 	swapchain_image_views = vkb_swapchain.get_image_views().value();
-	LOG(2, "Succesfully created swapchain");
+	LOG(2, "Succesfully created swapchain: " + std::string(string_VkPresentModeKHR(present_mode)) + ", "
+		+ std::to_string(swapchain_images.size()) + " images" + (compute_present_supported ? ", storage" : ""));
 }
 
 void Engine::resize_swapchain() {
@@ -34,10 +80,25 @@ void Engine::resize_swapchain() {
 		glfwWaitEvents();
 	}
 
-	vkDeviceWaitIdle(device);
-	destroy_swapchain();
-	create_swapchain(width, height);
+	//the old swapchain hands its images over to the new one, frames in flight may still present from it
+	VkSwapchainKHR old_swapchain = swapchain;
+	std::vector<VkImageView> old_views = swapchain_image_views;
+	create_swapchain(width, height, old_swapchain);
+	for (VkImageView view : old_views) {
+		deletion_queue.push_image_view(frame_counter, view);
+	}
+	deletion_queue.push_swapchain(frame_counter, old_swapchain);
 
+	//size dependent targets, transient_pool reallocates them on the next frame since their description changed
+	VkExtent3D target_extent = { swapchain_extent.width, swapchain_extent.height, 1 };
+	draw_image.extent = target_extent;
+	depth_image.extent = target_extent;
+	//reversed Z like init, the cascades refit to the new aspect through camera_version
+	camera.aspect = (float)swapchain_extent.width / (float)swapchain_extent.height;
+	ubo_data.proj = glm::perspectiveZO(glm::radians(camera.fov), camera.aspect, camera.far_plane, camera.near_plane);
+	ubo_data.proj[1][1] *= -1;
+	camera_version++;
+	resize_hitch_pending = true;
 }
 
 void Engine::destroy_swapchain() {
@@ -1,8 +1,23 @@
 #include "engine.h"
 /*
-create vert & ind vectors from OBJ
+create vert & ind vectors from OBJ, one instance per model matrix
+the scene version is bumped once for the whole batch
 */
-void Engine::load_obj(std::string file_name, glm::mat4 model = glm::mat4(1)) {
+void Engine::load_obj(std::string file_name, std::span<const glm::mat4> models) {
+	{
+		//already uploaded, only add instances of it
+		std::lock_guard<std::mutex> lock(scene_mutex);
+		auto cached = mesh_ids.find(file_name);
+		if (cached != mesh_ids.end()) {
+			for (const glm::mat4& model : models) {
+				instances.push_back({ cached->second, model });
+			}
+			scene_version++;
+			static_scene_version++;
+			return;
+		}
+	}
+
 	LOG(1, "Processing OBJ:" + file_name);
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
@@ -54,12 +69,60 @@ void Engine::load_obj(std::string file_name, glm::mat4 model = glm::mat4(1)) {
 	}
 
 	MeshData mesh = upload_mesh(vertices, indices);
-	mesh.model_mat = model;
-	meshes.push_back(mesh);
+	{
+		std::lock_guard<std::mutex> lock(scene_mutex);
+		uint32_t mesh_id = (uint32_t)meshes.size();
+		meshes.push_back(mesh);
+		mesh_ids[file_name] = mesh_id;
+		for (const glm::mat4& model : models) {
+			instances.push_back({ mesh_id, model });
+		}
+		scene_version++;
+		static_scene_version++;
+	}
 	LOG(1, "Uploaded " + file_name + " to GPU.");
 }
 
-void Engine::load_gltf(std::string file_name, glm::mat4 model = glm::mat4(1)) {
+/*
+removes a mesh and all of its instances, its buffers are freed once the frames drawing it have retired
+*/
+void Engine::unload_mesh(const std::string& file_name) {
+	std::lock_guard<std::mutex> lock(scene_mutex);
+	auto cached = mesh_ids.find(file_name);
+	if (cached == mesh_ids.end()) {
+		return;
+	}
+	uint32_t mesh_id = cached->second;
+	MeshData mesh = meshes[mesh_id];
+	deletion_queue.push_buffer(frame_counter, mesh.vertex_buffer.buffer, mesh.vertex_buffer.allocation);
+	deletion_queue.push_buffer(frame_counter, mesh.index_buffer.buffer, mesh.index_buffer.allocation);
+
+	//ids after it shift down one
+	meshes.erase(meshes.begin() + mesh_id);
+	mesh_ids.erase(cached);
+	for (auto& entry : mesh_ids) {
+		if (entry.second > mesh_id) {
+			entry.second--;
+		}
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < instances.size(); i++) {
+		if (instances[i].mesh_id == mesh_id) {
+			continue;
+		}
+		instances[kept] = instances[i];
+		if (instances[kept].mesh_id > mesh_id) {
+			instances[kept].mesh_id--;
+		}
+		kept++;
+	}
+	instances.resize(kept);
+	scene_version++;
+	static_scene_version++;
+	LOG(1, "Unloaded " + file_name + ", " + std::to_string(deletion_queue.pending_bytes / 1024) + "KB pending deletion.");
+}
+
+void Engine::load_gltf(std::string file_name, std::span<const glm::mat4> models) {
 	return;
 	LOG(1, "Processing GLTF: " + file_name);
 	std::vector<Vertex> vertices;
@@ -68,11 +131,64 @@ void Engine::load_gltf(std::string file_name, glm::mat4 model = glm::mat4(1)) {
 	//TODO TinyGltf/Fastgltf Loader
 
 	MeshData mesh = upload_mesh(vertices, indices);
-	mesh.model_mat = model;
-	meshes.push_back(mesh);
+	{
+		std::lock_guard<std::mutex> lock(scene_mutex);
+		uint32_t mesh_id = (uint32_t)meshes.size();
+		meshes.push_back(mesh);
+		mesh_ids[file_name] = mesh_id;
+		for (const glm::mat4& model : models) {
+			instances.push_back({ mesh_id, model });
+		}
+		scene_version++;
+		static_scene_version++;
+	}
 	LOG(1, "Uploaded " + file_name + " to GPU.");
 }
 
+/*
+marks every instance of a mesh as moving or static, moving instances are batched & shadowed apart
+*/
+void Engine::set_mesh_dynamic(const std::string& file_name, bool dynamic) {
+	std::lock_guard<std::mutex> lock(scene_mutex);
+	auto cached = mesh_ids.find(file_name);
+	if (cached == mesh_ids.end()) {
+		return;
+	}
+	for (MeshInstance& instance : instances) {
+		if (instance.mesh_id == cached->second) {
+			instance.dynamic = dynamic;
+		}
+	}
+	//its instances leave or join the static casters
+	scene_version++;
+	static_scene_version++;
+}
+
+/*
+spins the dynamic instances about their up axis while animating, only they are re-shadowed every frame
+*/
+void Engine::animate_instances() {
+	auto now = std::chrono::high_resolution_clock::now();
+	float dt = std::chrono::duration<float>(now - last_animation_update).count();
+	last_animation_update = now;
+	if (!animating) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(scene_mutex);
+	glm::mat4 spin = glm::rotate(glm::mat4(1.0f), glm::radians(45.0f) * dt, glm::vec3(0.0f, 1.0f, 0.0f));
+	bool moved = false;
+	for (MeshInstance& instance : instances) {
+		if (instance.dynamic) {
+			instance.model_mat = instance.model_mat * spin;
+			moved = true;
+		}
+	}
+	if (moved) {
+		scene_version++;
+	}
+}
+
 /*
 true if vkShaderModule successfully created, assigned to out_shader
 */
@@ -111,6 +227,12 @@ MeshData Engine::upload_mesh(std::span<Vertex> v, std::span<uint32_t> i) {
 
 	MeshData mesh = {};
 	mesh.index_count = (uint32_t)i.size();
+	mesh.bounds_min = v.empty() ? glm::vec3(0.0f) : v[0].pos;
+	mesh.bounds_max = mesh.bounds_min;
+	for (const Vertex& vertex : v) {
+		mesh.bounds_min = glm::min(mesh.bounds_min, vertex.pos);
+		mesh.bounds_max = glm::max(mesh.bounds_max, vertex.pos);
+	}
 
 
 	VkBufferCreateInfo vbuf_info = {};
@@ -288,6 +410,549 @@ void Engine::copy_image(VkCommandBuffer cmd, VkImage src_image, VkImage dst_imag
 	vkCmdBlitImage2(cmd, &blit_info);
 }
 
+/*
+moves the camera from held keys, mouse look is applied in handle_cursor_pos
+*/
+void Engine::update_camera() {
+	auto now = std::chrono::high_resolution_clock::now();
+	float dt = std::chrono::duration<float>(now - last_camera_update).count();
+	last_camera_update = now;
+
+	glm::vec3 forward = camera.forward();
+	glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	glm::vec3 move = glm::vec3(0.0f);
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) move += forward;
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) move -= forward;
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) move += right;
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) move -= right;
+	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) move += glm::vec3(0.0f, 1.0f, 0.0f);
+	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) move -= glm::vec3(0.0f, 1.0f, 0.0f);
+
+	if (move != glm::vec3(0.0f)) {
+		camera.pos += glm::normalize(move) * camera.speed * dt;
+		camera_version++;
+	}
+}
+
+/*
+copies the fields that changed since this frame's slice was last written
+field groups are versioned, a group is stale in a slice until every frame in flight has rewritten it
+*/
 void Engine::update_uniform_buffer() {
-	//ubo_data.view
+	update_camera();
+	PerFrameData& frame = frames.at(frame_number);
+
+	if (frame.camera_version != camera_version) {
+		ubo_data.view = glm::lookAt(camera.pos, camera.pos + camera.forward(), glm::vec3(0.0f, 1.0f, 0.0f));
+		ubo_data.eye_pos = camera.pos;
+	}
+	if (cascade_camera_version != camera_version) {
+		update_cascades();
+		cascade_camera_version = camera_version;
+	}
+	if (spot_camera_version != camera_version) {
+		update_spot_lights();
+		spot_camera_version = camera_version;
+	}
+	schedule_shadows();
+
+	struct FieldGroup {
+		size_t first;
+		size_t last;		//one past the end
+		uint64_t version;
+		uint64_t* written;
+	};
+	FieldGroup groups[] = {
+		{ offsetof(UniformBufferObject, view), offsetof(UniformBufferObject, cascade_view_proj), camera_version, &frame.camera_version },
+		{ offsetof(UniformBufferObject, cascade_view_proj), offsetof(UniformBufferObject, ka), light_version, &frame.light_version },
+		{ offsetof(UniformBufferObject, ka), offsetof(UniformBufferObject, spot_params), material_version, &frame.material_version },
+		{ offsetof(UniformBufferObject, spot_params), offsetof(UniformBufferObject, point_params), spot_light_version, &frame.spot_light_version },
+		{ offsetof(UniformBufferObject, point_params), sizeof(UniformBufferObject), point_light_version, &frame.point_light_version },
+	};
+
+	uint8_t* slice = frame_ring.slice_data(frame_number);
+	size_t dirty_first = sizeof(UniformBufferObject);
+	size_t dirty_last = 0;
+	for (FieldGroup& group : groups) {
+		if (*group.written == group.version) {
+			continue;
+		}
+		memcpy(slice + group.first, (uint8_t*)&ubo_data + group.first, group.last - group.first);
+		*group.written = group.version;
+		dirty_first = std::min(dirty_first, group.first);
+		dirty_last = std::max(dirty_last, group.last);
+		stats.cpu_write_bytes += (uint32_t)(group.last - group.first);
+	}
+	if (dirty_last > dirty_first) {
+		frame_ring.flush(vma_allocator, frame_number, dirty_first, dirty_last - dirty_first);
+	}
+}
+
+/*
+refits the shadow cascades to the current view, the light fields only change once schedule_shadows publishes them
+with SDSM the splits only span the visible depth range read back from the GPU
+*/
+void Engine::update_cascades() {
+	bool fitted = sample_distribution.enabled && sample_distribution.fitted;
+	float near_plane = fitted ? sample_distribution.near_plane : camera.near_plane;
+	float far_plane = fitted ? sample_distribution.far_plane : camera.far_plane;
+	cascades.fit(ubo_data.view, glm::radians(camera.fov), camera.aspect, near_plane, far_plane, ubo_data.light_dir);
+}
+
+/*
+picks the cascades, spot tiles & point cubes redrawn this frame, see shadow_scheduler.h
+the caches mark what is stale, the scheduler holds back what can wait and the caches record the rest as drawn
+published cascades are written to the light fields here, before the frame's slice is updated
+*/
+void Engine::schedule_shadows() {
+	bool dynamic_casters = std::any_of(draw_batches.begin(), draw_batches.end(), [](const DrawBatch& batch) { return batch.dynamic; });
+	shadow_atlas.begin_frame(spot_lights, batch_static_version, draw_batches);
+	point_shadows.begin_frame(point_lights, batch_static_version, draw_batches);
+
+	//casters a view's redraw would record, cascades are tested against their published projection, close enough to the fitted one
+	auto count_casters = [this](auto&& reaches) {
+		uint32_t count = 0;
+		for (const DrawBatch& batch : draw_batches) {
+			count += reaches(batch);
+		}
+		return count;
+	};
+	shadow_scheduler.begin_frame();
+
+	//a new split or an invalid cache redraws every cascade, they must all agree on the splits
+	bool all_cascades = shadow_cache.redraws_all(batch_static_version, shadow_cache.enabled && dynamic_casters);
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		all_cascades |= cascades.fitted[c].split_far != cascades.cascades[c].split_far;
+	}
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		if (!all_cascades && !cascades.pending(c)) {
+			continue;
+		}
+		//the first cascade updates every frame, one reaching twice as far every other frame
+		float importance = cascades.fitted[0].split_far / cascades.fitted[c].split_far;
+		uint32_t casters = count_casters([&](const DrawBatch& batch) { return cascades.intersects(c, batch.bounds_min, batch.bounds_max) ? 1u : 0u; });
+		bool forced = all_cascades || cascades.drift(c) > shadow_scheduler.max_drift;
+		shadow_scheduler.request(VIEW_CASCADE, c, shadow_scheduler.interval_for(importance), casters, forced);
+	}
+
+	for (uint32_t l = 0; l < spot_lights.size(); l++) {
+		const SpotLight& light = spot_lights[l];
+		if (!light.dirty) {
+			continue;
+		}
+		uint32_t casters = count_casters([&](const DrawBatch& batch) { return ShadowAtlas::intersects(light.view_proj, batch.bounds_min, batch.bounds_max) ? 1u : 0u; });
+		shadow_scheduler.request(VIEW_SPOT, l, shadow_scheduler.interval_for(light.importance), casters, light.forced);
+	}
+
+	glm::vec3 forward = camera.forward();
+	float tan_half_fov = std::tan(glm::radians(camera.fov) * 0.5f);
+	for (uint32_t l = 0; l < point_lights.size(); l++) {
+		const PointLight& light = point_lights[l];
+		if (light.dirty_mask == 0) {
+			continue;
+		}
+		float importance = ShadowAtlas::importance(light.pos, light.range, camera.pos, forward, tan_half_fov);
+		uint32_t casters = count_casters([&](const DrawBatch& batch) { return (uint32_t)std::popcount(PointShadows::face_mask(light, batch.bounds_min, batch.bounds_max) & light.dirty_mask); });
+		shadow_scheduler.request(VIEW_POINT, l, shadow_scheduler.interval_for(importance), casters, light.forced);
+	}
+
+	//dynamic casters are drawn into every cascade each frame over the cache, nothing to schedule
+	float fixed_ms = 0.0f;
+	if (shadow_cache.enabled && dynamic_casters) {
+		uint32_t dynamic_batches = count_casters([](const DrawBatch& batch) { return batch.dynamic ? 1u : 0u; });
+		fixed_ms = (float)(dynamic_batches * cascades.count) * shadow_scheduler.ms_per_draw;
+	}
+	shadow_scheduler.schedule(fixed_ms);
+
+	bool published = false;
+	for (uint32_t c = 0; c < cascades.count; c++) {
+		if (shadow_scheduler.scheduled(VIEW_CASCADE, c)) {
+			cascades.publish(c);
+			published = true;
+		}
+	}
+	if (published) {
+		for (uint32_t c = 0; c < MAX_SHADOW_CASCADES; c++) {
+			ubo_data.cascade_view_proj[c] = cascades.cascades[std::min(c, cascades.count - 1)].view_proj;
+			ubo_data.cascade_splits[c] = cascades.cascades[std::min(c, cascades.count - 1)].split_far;
+		}
+		ubo_data.cascade_params = glm::vec4((float)cascades.count, cascades.blend, cascades.cascades[0].split_near, 0.0f);
+		light_version++;
+	}
+	shadow_cache.begin_frame(cascades, batch_static_version, dynamic_casters);
+
+	for (uint32_t l = 0; l < spot_lights.size(); l++) {
+		spot_lights[l].dirty = spot_lights[l].dirty && shadow_scheduler.scheduled(VIEW_SPOT, l);
+	}
+	shadow_atlas.commit(spot_lights, batch_static_version);
+	for (uint32_t l = 0; l < point_lights.size(); l++) {
+		if (!shadow_scheduler.scheduled(VIEW_POINT, l)) {
+			point_lights[l].dirty_mask = 0;
+		}
+	}
+	point_shadows.commit(point_lights, batch_static_version);
+
+	stats.shadow_views = shadow_scheduler.frame_views;
+	stats.shadow_estimate_ms = shadow_scheduler.frame_ms;
+}
+
+/*
+hands out atlas tiles by how much of the view each spot light covers and rewrites the light array
+a light keeps its tile, and its cached depth, for as long as the order & sizes of the assignment hold
+*/
+void Engine::update_spot_lights() {
+	if (spot_lights_enabled) {
+		shadow_atlas.assign(spot_lights, camera.pos, camera.forward(), std::tan(glm::radians(camera.fov) * 0.5f));
+	}
+	else {
+		//no tiles, so nothing is drawn into the atlas while the lights are off
+		shadow_atlas.reset();
+		for (SpotLight& light : spot_lights) {
+			light.tile = { 0, 0, 0 };
+		}
+	}
+
+	uint32_t count = spot_lights_enabled ? (uint32_t)spot_lights.size() : 0;
+	float atlas_size = (float)shadow_atlas.size;
+	for (uint32_t i = 0; i < count; i++) {
+		const SpotLight& light = spot_lights[i];
+		SpotLightData& data = ubo_data.spot_lights[i];
+		data.view_proj = light.view_proj;
+		data.position_range = glm::vec4(light.pos, light.range);
+		data.direction_cos_outer = glm::vec4(light.dir, std::cos(glm::radians(light.outer_angle)));
+		data.color_cos_inner = glm::vec4(light.col, std::cos(glm::radians(light.inner_angle)));
+		data.atlas_rect = glm::vec4(light.tile.x / atlas_size, light.tile.y / atlas_size, light.tile.size / atlas_size, light.tile.size / atlas_size);
+	}
+	ubo_data.spot_params = glm::vec4((float)count, 1.0f / atlas_size, 0.0f, 0.0f);
+	spot_light_version++;
+}
+
+/*
+reallocates frame_ring with room for instance_bytes per slice
+frames in flight keep reading the old ring & global_set, both are retired and the new ring gets a fresh set
+every slice is marked stale
+*/
+void Engine::grow_frame_ring(size_t instance_bytes) {
+	VkDeviceSize old_size = frame_ring.slice_size;
+	deletion_queue.push_buffer(frame_counter, frame_ring.buffer.buffer, frame_ring.buffer.allocation);
+	VkDescriptorSet old_set = global_set;
+	if (old_set != VK_NULL_HANDLE) {
+		deletion_queue.push_callback(frame_counter, [this, old_set]() {
+			spare_global_sets.push_back(old_set);
+		});
+	}
+	frame_ring.buffer = {};
+
+	VkDeviceSize slice_size = std::max<VkDeviceSize>(ring_instance_offset + instance_bytes, old_size * 2);
+	frame_ring.create(device, vma_allocator, frames_in_flight, FrameRing::align_up(slice_size, uniform_alignment));
+
+	if (descriptor_buffer_enabled) {
+		//each frame rewrites its own copy after its fence
+		descriptor_version++;
+	}
+	else {
+		if (!spare_global_sets.empty()) {
+			global_set = spare_global_sets.back();
+			spare_global_sets.pop_back();
+		}
+		else {
+			descriptor_builder.allocate_set(device, global_layout, &global_set);
+		}
+		write_global_set(global_set);
+	}
+
+	for (PerFrameData& frame : frames) {
+		frame.scene_version = UINT64_MAX;
+		frame.camera_version = 0;
+		frame.light_version = 0;
+		frame.material_version = 0;
+		frame.spot_light_version = 0;
+		frame.point_light_version = 0;
+	}
+	LOG(4, "Resized frame ring to " + std::to_string(frame_ring.slice_size) + " bytes per frame.");
+}
+
+/*
+ring uniform buffer, shadowmap, moments, atlas & point cube samplers & views
+*/
+void Engine::write_global_set(VkDescriptorSet set) {
+	//Ubo, offset to the frame's ring slice at bind time
+	VkDescriptorBufferInfo buffer_info = {};
+	buffer_info.buffer = frame_ring.buffer.buffer;
+	buffer_info.offset = 0;
+	buffer_info.range = sizeof(UniformBufferObject);
+
+	VkWriteDescriptorSet ubo_write = {};
+	ubo_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	ubo_write.pNext = nullptr;
+	ubo_write.dstBinding = 0;
+	ubo_write.dstSet = set;
+	ubo_write.descriptorCount = 1;
+	ubo_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	ubo_write.pBufferInfo = &buffer_info;
+
+	//Sampler
+	VkDescriptorImageInfo sampler_info = {};
+	sampler_info.sampler = shadowmap_sampler;
+
+	VkWriteDescriptorSet sampler_write = {};
+	sampler_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	sampler_write.pNext = nullptr;
+	sampler_write.dstBinding = 1;
+	sampler_write.dstSet = set;
+	sampler_write.descriptorCount = 1;
+	sampler_write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	sampler_write.pImageInfo = &sampler_info;
+
+	//SampledImage
+	VkDescriptorImageInfo sampled_img_info = {};
+	sampled_img_info.imageView = shadowmap_image.view;
+	sampled_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet sampled_img_write = {};
+	sampled_img_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	sampled_img_write.pNext = nullptr;
+	sampled_img_write.dstBinding = 2;
+	sampled_img_write.dstSet = set;
+	sampled_img_write.descriptorCount = 1;
+	sampled_img_write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	sampled_img_write.pImageInfo = &sampled_img_info;
+
+	//Comparison sampler
+	VkDescriptorImageInfo compare_sampler_info = {};
+	compare_sampler_info.sampler = shadowmap_compare_sampler;
+
+	VkWriteDescriptorSet compare_sampler_write = sampler_write;
+	compare_sampler_write.dstBinding = 3;
+	compare_sampler_write.pImageInfo = &compare_sampler_info;
+
+	//EVSM moments & their sampler
+	VkDescriptorImageInfo moments_img_info = {};
+	moments_img_info.imageView = moments_image.view;
+	moments_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet moments_img_write = sampled_img_write;
+	moments_img_write.dstBinding = 4;
+	moments_img_write.pImageInfo = &moments_img_info;
+
+	VkDescriptorImageInfo moments_sampler_info = {};
+	moments_sampler_info.sampler = moments_sampler;
+
+	VkWriteDescriptorSet moments_sampler_write = sampler_write;
+	moments_sampler_write.dstBinding = 5;
+	moments_sampler_write.pImageInfo = &moments_sampler_info;
+
+	//Spot light shadow atlas
+	VkDescriptorImageInfo atlas_img_info = {};
+	atlas_img_info.imageView = atlas_image.view;
+	atlas_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet atlas_img_write = sampled_img_write;
+	atlas_img_write.dstBinding = 6;
+	atlas_img_write.pImageInfo = &atlas_img_info;
+
+	//Point light cubes
+	VkDescriptorImageInfo point_img_info = {};
+	point_img_info.imageView = point_cube_view;
+	point_img_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet point_img_write = sampled_img_write;
+	point_img_write.dstBinding = 7;
+	point_img_write.pImageInfo = &point_img_info;
+
+	VkWriteDescriptorSet write_sets[] = { ubo_write, sampler_write, sampled_img_write, compare_sampler_write, moments_img_write, moments_sampler_write, atlas_img_write, point_img_write };
+	vkUpdateDescriptorSets(device, 8, write_sets, 0, nullptr);
+}
+
+/*
+descriptor buffer copy of the global set for frame, only written once its fence has signalled
+*/
+void Engine::write_descriptor_buffer(uint32_t frame) {
+	//Ubo, this frame's ring slice
+	VkDescriptorAddressInfoEXT ubo_address = {};
+	ubo_address.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT;
+	ubo_address.pNext = nullptr;
+	ubo_address.address = frame_ring.slice_address(frame);
+	ubo_address.range = sizeof(UniformBufferObject);
+	ubo_address.format = VK_FORMAT_UNDEFINED;
+
+	VkDescriptorGetInfoEXT ubo_info = {};
+	ubo_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+	ubo_info.pNext = nullptr;
+	ubo_info.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	ubo_info.data.pUniformBuffer = &ubo_address;
+	descriptor_buffer.write(device, global_layout, frame, 0, ubo_info, descriptor_buffer.properties.uniformBufferDescriptorSize);
+
+	//Sampler
+	VkDescriptorGetInfoEXT sampler_info = {};
+	sampler_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+	sampler_info.pNext = nullptr;
+	sampler_info.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	sampler_info.data.pSampler = &shadowmap_sampler;
+	descriptor_buffer.write(device, global_layout, frame, 1, sampler_info, descriptor_buffer.properties.samplerDescriptorSize);
+
+	//SampledImage
+	VkDescriptorImageInfo sampled_img = {};
+	sampled_img.imageView = shadowmap_image.view;
+	sampled_img.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkDescriptorGetInfoEXT sampled_img_info = {};
+	sampled_img_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+	sampled_img_info.pNext = nullptr;
+	sampled_img_info.type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	sampled_img_info.data.pSampledImage = &sampled_img;
+	descriptor_buffer.write(device, global_layout, frame, 2, sampled_img_info, descriptor_buffer.properties.sampledImageDescriptorSize);
+
+	//Comparison sampler
+	sampler_info.data.pSampler = &shadowmap_compare_sampler;
+	descriptor_buffer.write(device, global_layout, frame, 3, sampler_info, descriptor_buffer.properties.samplerDescriptorSize);
+
+	//EVSM moments & their sampler
+	VkDescriptorImageInfo moments_img = {};
+	moments_img.imageView = moments_image.view;
+	moments_img.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sampled_img_info.data.pSampledImage = &moments_img;
+	descriptor_buffer.write(device, global_layout, frame, 4, sampled_img_info, descriptor_buffer.properties.sampledImageDescriptorSize);
+
+	sampler_info.data.pSampler = &moments_sampler;
+	descriptor_buffer.write(device, global_layout, frame, 5, sampler_info, descriptor_buffer.properties.samplerDescriptorSize);
+
+	//Spot light shadow atlas
+	VkDescriptorImageInfo atlas_img = {};
+	atlas_img.imageView = atlas_image.view;
+	atlas_img.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sampled_img_info.data.pSampledImage = &atlas_img;
+	descriptor_buffer.write(device, global_layout, frame, 6, sampled_img_info, descriptor_buffer.properties.sampledImageDescriptorSize);
+
+	//Point light cubes
+	VkDescriptorImageInfo point_img = {};
+	point_img.imageView = point_cube_view;
+	point_img.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sampled_img_info.data.pSampledImage = &point_img;
+	descriptor_buffer.write(device, global_layout, frame, 7, sampled_img_info, descriptor_buffer.properties.sampledImageDescriptorSize);
+
+	descriptor_buffer.flush(vma_allocator, frame);
+}
+
+/*
+brings this frame's global descriptors up to date, the classic set is static and only replaced by ring growth
+*/
+void Engine::update_global_descriptors() {
+	auto start = std::chrono::high_resolution_clock::now();
+	PerFrameData& frame = frames.at(frame_number);
+	if (descriptor_buffer_enabled && frame.descriptor_version != descriptor_version) {
+		write_descriptor_buffer(frame_number);
+		frame.descriptor_version = descriptor_version;
+	}
+	stats.descriptor_update_us = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+/*
+called after waiting on this frame's fence, every frame up to frame_counter - frames_in_flight has retired
+*/
+void Engine::flush_deletions() {
+	if (frame_counter >= frames_in_flight) {
+		deletion_queue.flush(frame_counter - frames_in_flight);
+	}
+}
+
+/*
+rebuild draw batches and this frame's instance transforms if the scene changed since they were last written
+instances are counting sorted by mesh so every mesh is a single instanced draw
+*/
+void Engine::update_instance_buffer() {
+	PerFrameData& frame = frames.at(frame_number);
+
+	std::lock_guard<std::mutex> lock(scene_mutex);
+	if (frame.scene_version == scene_version) {
+		return;
+	}
+
+	//one bucket for the static & one for the dynamic instances of each mesh
+	auto bucket_of = [](const MeshInstance& instance) { return instance.mesh_id * 2 + (instance.dynamic ? 1 : 0); };
+	size_t bucket_count = meshes.size() * 2;
+	std::vector<uint32_t> offsets(bucket_count + 1, 0);
+	std::vector<glm::vec3> centers(bucket_count, glm::vec3(0.0f));
+	std::vector<glm::vec3> bounds_min(bucket_count, glm::vec3(std::numeric_limits<float>::max()));
+	std::vector<glm::vec3> bounds_max(bucket_count, glm::vec3(-std::numeric_limits<float>::max()));
+	for (const MeshInstance& instance : instances) {
+		uint32_t bucket = bucket_of(instance);
+		offsets[bucket + 1]++;
+		centers[bucket] += glm::vec3(instance.model_mat[3]);
+
+		//object space box to a world space box around it
+		const MeshData& mesh = meshes[instance.mesh_id];
+		glm::vec3 center = glm::vec3(instance.model_mat * glm::vec4((mesh.bounds_min + mesh.bounds_max) * 0.5f, 1.0f));
+		glm::vec3 extent = (mesh.bounds_max - mesh.bounds_min) * 0.5f;
+		glm::vec3 world_extent = glm::abs(glm::vec3(instance.model_mat[0])) * extent.x
+			+ glm::abs(glm::vec3(instance.model_mat[1])) * extent.y + glm::abs(glm::vec3(instance.model_mat[2])) * extent.z;
+		bounds_min[bucket] = glm::min(bounds_min[bucket], center - world_extent);
+		bounds_max[bucket] = glm::max(bounds_max[bucket], center + world_extent);
+	}
+	for (size_t m = 1; m < offsets.size(); m++) {
+		offsets[m] += offsets[m - 1];
+	}
+
+	draw_batches.clear();
+	for (uint32_t b = 0; b < bucket_count; b++) {
+		uint32_t count = offsets[b + 1] - offsets[b];
+		if (count == 0) {
+			continue;
+		}
+		uint32_t m = b / 2;
+		DrawBatch batch = {};
+		batch.index_buffer = meshes[m].index_buffer.buffer;
+		batch.vertex_buffer_address = meshes[m].vertex_buffer_address;
+		batch.index_count = meshes[m].index_count;
+		batch.mesh_id = m;
+		batch.material_id = 0;
+		batch.first_instance = offsets[b];
+		batch.instance_count = count;
+		batch.dynamic = (b & 1) != 0;
+		batch.center = centers[b] / (float)count;
+		batch.bounds_min = bounds_min[b];
+		batch.bounds_max = bounds_max[b];
+		draw_batches.push_back(batch);
+	}
+	batch_static_version = static_scene_version;
+
+	size_t required_size = instances.size() * sizeof(glm::mat4);
+	if (ring_instance_offset + required_size > frame_ring.slice_size) {
+		grow_frame_ring(required_size);
+	}
+
+	if (required_size > 0) {
+		glm::mat4* models = (glm::mat4*)(frame_ring.slice_data(frame_number) + ring_instance_offset);
+		for (const MeshInstance& instance : instances) {
+			models[offsets[bucket_of(instance)]++] = instance.model_mat;
+		}
+		frame_ring.flush(vma_allocator, frame_number, ring_instance_offset, required_size);
+		stats.cpu_write_bytes += (uint32_t)required_size;
+	}
+
+	frame.scene_version = scene_version;
+	stats.instances = (uint32_t)instances.size();
+}
+
+void Engine::queue_mesh(const MeshResource& res) {
+	std::lock_guard<std::mutex> lock(mesh_queue_mutex);
+	mesh_queue.push(res);
+}
+
+/*
+queue count instances of res laid out on a square grid around its model matrix
+*/
+void Engine::spawn_instance_grid(const MeshResource& res, uint32_t count) {
+	uint32_t side = (uint32_t)std::ceil(std::sqrt((float)count));
+	float spacing = 2.5f;
+	glm::vec3 origin = glm::vec3(-0.5f * spacing * side, 0.0f, -0.5f * spacing * side);
+
+	std::lock_guard<std::mutex> lock(mesh_queue_mutex);
+	for (uint32_t i = 0; i < count; i++) {
+		MeshResource instance = res;
+		glm::vec3 offset = origin + glm::vec3(spacing * (i % side), 0.0f, spacing * (i / side));
+		instance.model_mat = glm::translate(glm::mat4(1), offset) * res.model_mat;
+		mesh_queue.push(instance);
+	}
+	LOG(1, "Queued " + std::to_string(count) + " instances of " + res.file_path);
 }
\ No newline at end of file
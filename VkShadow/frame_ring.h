@@ -0,0 +1,65 @@
+#pragma once
+//Per frame upload ring
+/*
+one persistently mapped buffer split into a slice per frame in flight
+a frame only writes its own slice after its fence has signalled, so the GPU never reads data being written
+slices are bound as a dynamic uniform buffer offset and by buffer device address
+*/
+struct FrameRing {
+	BufferData buffer = {};
+	VkDeviceAddress address = 0;
+	VkDeviceSize slice_size = 0;
+	uint32_t slice_count = 0;
+
+	static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	/*
+	slice_size must already be aligned to minUniformBufferOffsetAlignment
+	*/
+	void create(VkDevice device, VmaAllocator allocator, uint32_t count, VkDeviceSize size) {
+		slice_count = count;
+		slice_size = size;
+
+		VkBufferCreateInfo buffer_info = {};
+		buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_info.pNext = nullptr;
+		buffer_info.size = slice_size * slice_count;
+		buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+		VmaAllocationCreateInfo allocation_info = {};
+		allocation_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		allocation_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+		VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &allocation_info, &buffer.buffer, &buffer.allocation, &buffer.info));
+
+		VkBufferDeviceAddressInfo addr_info = {};
+		addr_info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+		addr_info.buffer = buffer.buffer;
+		address = vkGetBufferDeviceAddress(device, &addr_info);
+	}
+
+	void destroy(VmaAllocator allocator) {
+		if (buffer.buffer != VK_NULL_HANDLE) {
+			vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+		}
+		buffer = {};
+		address = 0;
+	}
+
+	VkDeviceSize slice_offset(uint32_t frame) const {
+		return slice_size * frame;
+	}
+
+	uint8_t* slice_data(uint32_t frame) const {
+		return (uint8_t*)buffer.info.pMappedData + slice_offset(frame);
+	}
+
+	VkDeviceAddress slice_address(uint32_t frame) const {
+		return address + slice_offset(frame);
+	}
+
+	void flush(VmaAllocator allocator, uint32_t frame, VkDeviceSize offset, VkDeviceSize size) const {
+		vmaFlushAllocation(allocator, buffer.allocation, slice_offset(frame) + offset, size);
+	}
+};
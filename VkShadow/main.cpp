@@ -1,8 +1,119 @@
 #include "engine.h"
-int main() {
 
-	Engine engine(1280, 720);
+static const char* usage =
+	"Options:\n"
+	"  --frames-in-flight <1-4>\n"
+	"  --present-mode <fifo|fifo_relaxed|mailbox|immediate>\n"
+	"  --dynamic-resolution <target GPU ms>\n"
+	"  --min-scale <0.1-1.0>\n"
+	"  --shadow-bias <depth bias>\n"
+	"  --descriptor-buffer <on|off>\n"
+	"  --cascades <2-4>\n"
+	"  --shadow-cache <on|off>\n"
+	"  --shadow-filter <off|hard|pcf|poisson|pcss|evsm>\n"
+	"  --filter-taps <1-32>\n"
+	"  --spot-lights <0-32>\n"
+	"  --point-lights <0-4>\n"
+	"  --sdsm <on|off>\n"
+	"  --shadow-budget <GPU ms|off>\n";
+
+/*
+reads value into out, a value that isn't a number of out's type keeps the default and prints the usage
+*/
+template<typename T>
+static bool parse_number(const std::string& option, const std::string& value, T& out) {
+	try {
+		size_t used = 0;
+		double number = std::stod(value, &used);
+		bool valid = std::is_floating_point_v<T> || (number >= 0.0 && number <= (double)std::numeric_limits<T>::max() && number == std::floor(number));
+		if (used != value.size() || !valid) {
+			throw std::invalid_argument(value);
+		}
+		out = (T)number;
+		return true;
+	}
+	catch (const std::exception&) {
+		std::cout << "Invalid value " << value << " for " << option << ", using " << out << std::endl << usage;
+		return false;
+	}
+}
+
+/*
+command line options, see usage, unknown options & bad values are reported and skipped
+*/
+static EngineConfig parse_config(int argc, char** argv) {
+	EngineConfig config = {};
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+		std::string value = argv[i + 1];
+		if (option == "--frames-in-flight") {
+			parse_number(option, value, config.frames_in_flight);
+		}
+		else if (option == "--present-mode") {
+			if (value == "fifo") config.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+			else if (value == "fifo_relaxed") config.present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+			else if (value == "mailbox") config.present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+			else if (value == "immediate") config.present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			else std::cout << "Unknown present mode " << value << ", using fifo" << std::endl;
+		}
+		else if (option == "--dynamic-resolution") {
+			config.dynamic_resolution = parse_number(option, value, config.target_frame_ms);
+		}
+		else if (option == "--min-scale") {
+			parse_number(option, value, config.min_render_scale);
+		}
+		else if (option == "--shadow-bias") {
+			parse_number(option, value, config.shadow_bias);
+		}
+		else if (option == "--descriptor-buffer") {
+			config.descriptor_buffer = value != "off";
+		}
+		else if (option == "--cascades") {
+			parse_number(option, value, config.shadow_cascades);
+		}
+		else if (option == "--shadow-cache") {
+			config.shadow_cache = value != "off";
+		}
+		else if (option == "--shadow-filter") {
+			if (value == "off") config.shadow_mode = SHADOW_OFF;
+			else if (value == "hard") config.shadow_mode = SHADOW_HARD;
+			else if (value == "pcf") config.shadow_mode = SHADOW_PCF;
+			else if (value == "poisson") config.shadow_mode = SHADOW_POISSON;
+			else if (value == "pcss") config.shadow_mode = SHADOW_PCSS;
+			else if (value == "evsm") config.shadow_mode = SHADOW_EVSM;
+			else std::cout << "Unknown shadow filter " << value << ", using pcf" << std::endl;
+		}
+		else if (option == "--filter-taps") {
+			parse_number(option, value, config.filter_taps);
+		}
+		else if (option == "--spot-lights") {
+			parse_number(option, value, config.spot_lights);
+		}
+		else if (option == "--point-lights") {
+			parse_number(option, value, config.point_lights);
+		}
+		else if (option == "--sdsm") {
+			config.sdsm = value != "off";
+		}
+		else if (option == "--shadow-budget") {
+			if (value == "off") {
+				config.shadow_budget_ms = 0.0f;
+			}
+			else {
+				parse_number(option, value, config.shadow_budget_ms);
+			}
+		}
+		else {
+			std::cout << "Unknown option " << option << std::endl << usage;
+		}
+	}
+	return config;
+}
+
+int main(int argc, char** argv) {
+
+	Engine engine(1280, 720, parse_config(argc, argv));
 	engine.run();
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+#pragma once
+//Pipeline cache
+/*
+VkPipelineCache persisted between runs so pipelines are created from the driver's compiled binaries
+instead of SPIR-V after the first launch
+the blob is only trusted if its header matches this device & driver, a mismatch starts an empty (cold) cache
+saved to a temporary file & renamed over the old one so a crash mid write never leaves a truncated cache
+*/
+struct PipelineCache {
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	bool warm = false;				//started from valid data saved by a previous run
+	size_t loaded_bytes = 0;
+	std::string rejected_reason;	//why saved data was discarded, empty if none
+
+	/*
+	pipelineCacheUUID changes with the driver build, vendor & device ids catch a different GPU
+	*/
+	bool validate(const std::vector<char>& data, const VkPhysicalDeviceProperties& properties) {
+		if (data.size() < sizeof(VkPipelineCacheHeaderVersionOne)) {
+			rejected_reason = "too small for a header";
+			return false;
+		}
+		VkPipelineCacheHeaderVersionOne header = {};
+		memcpy(&header, data.data(), sizeof(header));
+		if (header.headerSize < sizeof(VkPipelineCacheHeaderVersionOne) || header.headerSize > data.size()) {
+			rejected_reason = "bad header size";
+			return false;
+		}
+		if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+			rejected_reason = "unknown header version";
+			return false;
+		}
+		if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID) {
+			rejected_reason = "different device";
+			return false;
+		}
+		if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			rejected_reason = "different driver";
+			return false;
+		}
+		return true;
+	}
+
+	void load(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& file_path) {
+		path = file_path;
+		std::vector<char> data;
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (file.is_open()) {
+			std::streamoff size = file.tellg();
+			if (file && size > 0) {
+				data.resize((size_t)size);
+				file.seekg(0);
+				file.read(data.data(), data.size());
+			}
+			//a failed size or short read is treated as no cache
+			if (!file) {
+				rejected_reason = "unreadable";
+				data.clear();
+			}
+			else if (!validate(data, properties)) {
+				data.clear();
+			}
+			file.close();
+		}
+
+		VkPipelineCacheCreateInfo cache_info = {};
+		cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		cache_info.pNext = nullptr;
+		cache_info.initialDataSize = data.size();
+		cache_info.pInitialData = data.empty() ? nullptr : data.data();
+		VK_CHECK(vkCreatePipelineCache(device, &cache_info, nullptr, &cache));
+
+		warm = !data.empty();
+		loaded_bytes = data.size();
+	}
+
+	/*
+	false if the data couldn't be written, the previous file is left untouched
+	*/
+	bool save(VkDevice device) {
+		if (cache == VK_NULL_HANDLE || path.empty()) {
+			return false;
+		}
+		size_t size = 0;
+		if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0) {
+			return false;
+		}
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS) {
+			return false;
+		}
+
+		std::string temp_path = path + ".tmp";
+		{
+			std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) {
+				return false;
+			}
+			file.write(data.data(), size);
+			if (!file.good()) {
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temp_path, path, error);
+		if (error) {
+			std::filesystem::remove(temp_path, error);
+			return false;
+		}
+		return true;
+	}
+
+	void destroy(VkDevice device) {
+		vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+	}
+};
@@ -0,0 +1,183 @@
+#pragma once
+//Pipeline registry
+/*
+pipelines keyed by a hash of their full description, identical state returns the pipeline already built
+a hit is checked against the stored description, a colliding description probes on to the next key
+new state compiles on the compile pool while callers keep drawing with a fallback
+entries are only touched on the main thread, a worker only writes its own entry before done is ready
+variants nothing has drawn with for a while are evicted, their pipelines go through the deletion queue
+*/
+struct PipelineEntry {
+	PipelineDesc desc;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	std::future<void> done;
+	double compile_ms = 0.0;
+	uint64_t last_used = 0;		//last frame the pipeline was bound, or it was still compiling
+	bool ready = false;
+};
+
+struct PipelineRegistry {
+	std::unordered_map<size_t, PipelineEntry> entries;		//node based, entries don't move when others are added
+	std::unordered_map<std::string, uint64_t> spirv_hashes;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t fallbacks = 0;		//lookups answered with the fallback while their pipeline compiled
+	uint64_t evicted = 0;
+
+	static void hash_combine(size_t& seed, uint64_t value) {
+		seed ^= std::hash<uint64_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	}
+
+	/*
+	FNV-1a of the SPIR-V, read once per path, a missing file hashes to 0 and fails when compiled
+	*/
+	uint64_t spirv_hash(const char* path) {
+		if (path == nullptr) {
+			return 0;
+		}
+		auto cached = spirv_hashes.find(path);
+		if (cached != spirv_hashes.end()) {
+			return cached->second;
+		}
+		uint64_t hash = 0;
+		std::ifstream file(path, std::ios::binary);
+		if (file.is_open()) {
+			hash = 0xcbf29ce484222325ull;
+			std::vector<char> code((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			for (char c : code) {
+				hash = (hash ^ (uint8_t)c) * 0x100000001b3ull;
+			}
+		}
+		spirv_hashes[path] = hash;
+		return hash;
+	}
+
+	/*
+	everything that ends up in the create info, the name & first_frame only affect scheduling
+	*/
+	size_t hash_desc(const PipelineDesc& desc) {
+		size_t seed = 0;
+		hash_combine(seed, spirv_hash(desc.vert_path));
+		hash_combine(seed, spirv_hash(desc.frag_path));
+		hash_combine(seed, spirv_hash(desc.comp_path));
+		hash_combine(seed, (uint64_t)desc.layout);
+		hash_combine(seed, desc.flags);
+		hash_combine(seed, desc.topology);
+		hash_combine(seed, desc.polygon_mode);
+		hash_combine(seed, desc.cull_mode);
+		hash_combine(seed, desc.front_face);
+		hash_combine(seed, desc.depth_test ? 1 : 0);
+		hash_combine(seed, desc.depth_write);
+		hash_combine(seed, desc.depth_op);
+		hash_combine(seed, desc.blending ? 1 : 0);
+		hash_combine(seed, desc.dst_blend_factor);
+		hash_combine(seed, desc.color_format);
+		hash_combine(seed, desc.depth_format);
+		hash_combine(seed, desc.spec_data.empty() ? 0 : desc.spec_stage);
+		for (const VkSpecializationMapEntry& entry : desc.spec_entries) {
+			hash_combine(seed, ((uint64_t)entry.constantID << 32) | entry.offset);
+		}
+		for (size_t i = 0; i < desc.spec_data.size(); i += 4) {
+			uint32_t word = 0;
+			memcpy(&word, desc.spec_data.data() + i, std::min<size_t>(4, desc.spec_data.size() - i));
+			hash_combine(seed, word);
+		}
+		return seed;
+	}
+
+	static bool same_path(const char* a, const char* b) {
+		return a == b || (a != nullptr && b != nullptr && strcmp(a, b) == 0);
+	}
+
+	/*
+	the fields hash_desc covers, shader paths by name since their SPIR-V is read once per path
+	*/
+	static bool same_state(const PipelineDesc& a, const PipelineDesc& b) {
+		return same_path(a.vert_path, b.vert_path) && same_path(a.frag_path, b.frag_path) && same_path(a.comp_path, b.comp_path)
+			&& a.layout == b.layout && a.flags == b.flags && a.topology == b.topology && a.polygon_mode == b.polygon_mode
+			&& a.cull_mode == b.cull_mode && a.front_face == b.front_face && a.depth_test == b.depth_test && a.depth_write == b.depth_write
+			&& a.depth_op == b.depth_op && a.blending == b.blending && a.dst_blend_factor == b.dst_blend_factor
+			&& a.color_format == b.color_format && a.depth_format == b.depth_format
+			&& (a.spec_data.empty() ? 0 : a.spec_stage) == (b.spec_data.empty() ? 0 : b.spec_stage) && a.spec_data == b.spec_data
+			&& a.spec_entries.size() == b.spec_entries.size()
+			&& std::equal(a.spec_entries.begin(), a.spec_entries.end(), b.spec_entries.begin(), [](const VkSpecializationMapEntry& x, const VkSpecializationMapEntry& y) {
+				return x.constantID == y.constantID && x.offset == y.offset && x.size == y.size;
+			});
+	}
+
+	/*
+	nullptr on a miss, key is then the free slot the caller inserts at before queueing the compile
+	*/
+	PipelineEntry* find(size_t& key, const PipelineDesc& desc) {
+		for (auto entry = entries.find(key); entry != entries.end(); entry = entries.find(++key)) {
+			if (same_state(entry->second.desc, desc)) {
+				hits++;
+				return &entry->second;
+			}
+		}
+		misses++;
+		return nullptr;
+	}
+
+	PipelineEntry& insert(size_t key, const PipelineDesc& desc) {
+		PipelineEntry& entry = entries[key];
+		entry.desc = desc;
+		return entry;
+	}
+
+	/*
+	marks finished compiles ready and returns them, compile errors are rethrown on the calling thread
+	*/
+	std::vector<PipelineEntry*> poll() {
+		std::vector<PipelineEntry*> finished;
+		for (auto& [key, entry] : entries) {
+			if (entry.ready || !entry.done.valid() || entry.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				continue;
+			}
+			entry.done.get();
+			entry.ready = true;
+			finished.push_back(&entry);
+		}
+		return finished;
+	}
+
+	/*
+	erases ready entries whose pipeline isn't in bound and hasn't been for max_unused frames, returns their pipelines
+	an erase can end a colliding description's probe chain early, that only costs it a recompile
+	*/
+	std::vector<VkPipeline> evict(uint64_t frame, uint64_t max_unused, const std::vector<VkPipeline>& bound) {
+		std::vector<VkPipeline> evicted_pipelines;
+		for (auto entry = entries.begin(); entry != entries.end();) {
+			PipelineEntry& e = entry->second;
+			if (!e.ready || std::find(bound.begin(), bound.end(), e.pipeline) != bound.end()) {
+				e.last_used = frame;
+			}
+			if (frame - e.last_used < max_unused) {
+				++entry;
+				continue;
+			}
+			evicted_pipelines.push_back(e.pipeline);
+			evicted++;
+			entry = entries.erase(entry);
+		}
+		return evicted_pipelines;
+	}
+
+	uint32_t compiled_count() const {
+		uint32_t count = 0;
+		for (const auto& [key, entry] : entries) {
+			count += entry.ready ? 1 : 0;
+		}
+		return count;
+	}
+
+	void destroy(VkDevice device) {
+		for (auto& [key, entry] : entries) {
+			if (entry.done.valid()) {
+				entry.done.wait();
+			}
+			vkDestroyPipeline(device, entry.pipeline, nullptr);
+		}
+		entries.clear();
+	}
+};
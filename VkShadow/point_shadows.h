@@ -0,0 +1,115 @@
+#pragma once
+//Point light shadows
+/*
+each point light renders six 90 degree faces into six layers of one cube array, all lights & faces in one layered pass
+a batch gets one draw per face whose frustum its bounds reach, so a caster beside the light costs one or two faces, not six
+faces store linear distance to the light over its range, written by point_shadow.frag, so the compare and its bias
+mean the same thing at every distance instead of following the perspective depth curve
+like the atlas a face is only redrawn when its static casters changed or a dynamic caster is or was inside it
+and like it begin_frame only marks the faces, commit records the lights the scheduler let through as drawn
+*/
+struct PointLight {
+	glm::vec3 pos;
+	glm::vec3 col;
+	float range;
+	glm::mat4 face_view_proj[6];		//+x -x +y -y +z -z, oriented to match cube map sampling
+
+	//what the faces hold, see PointShadows::begin_frame
+	uint64_t drawn_static_version;
+	uint32_t drawn_dynamic_mask;		//faces a dynamic caster was inside when they were drawn
+	uint32_t dynamic_mask;				//faces a dynamic caster is inside this frame
+	uint32_t dirty_mask;				//faces redrawn this frame
+	bool forced;						//nothing usable drawn yet or drawn from an old static scene, it can't wait
+	bool drawn;
+};
+
+struct PointShadows {
+	uint32_t resolution = 512;		//per face
+	float near_plane = 0.05f;
+	bool enabled = true;				//off redraws every face every frame
+
+	//since the last report
+	uint32_t frames = 0;
+	uint32_t face_frames = 0;
+	uint32_t face_redraws = 0;
+	uint32_t casters = 0;			//face draws recorded
+	uint32_t culled = 0;			//face draws skipped by the per face test
+
+	/*
+	the six face projections of a light, its range is the far plane
+	no y flip, a face rendered the GL way lands in memory where cube sampling looks for it
+	*/
+	void fit(PointLight& light) const {
+		static const glm::vec3 directions[6] = {
+			{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }
+		};
+		static const glm::vec3 ups[6] = {
+			{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }
+		};
+		glm::mat4 proj = glm::perspectiveZO(glm::radians(90.0f), 1.0f, light.range, near_plane);
+		for (uint32_t f = 0; f < 6; f++) {
+			light.face_view_proj[f] = proj * glm::lookAt(light.pos, light.pos + directions[f], ups[f]);
+		}
+	}
+
+	/*
+	call once per recorded frame before scheduling, marks the faces that would be redrawn
+	*/
+	void begin_frame(std::vector<PointLight>& lights, uint64_t static_version, const std::vector<DrawBatch>& batches) {
+		frames++;
+		for (PointLight& light : lights) {
+			light.dynamic_mask = 0;
+			for (const DrawBatch& batch : batches) {
+				if (batch.dynamic) {
+					light.dynamic_mask |= face_mask(light, batch.bounds_min, batch.bounds_max);
+				}
+			}
+			light.forced = !enabled || !light.drawn || static_version != light.drawn_static_version;
+			light.dirty_mask = light.forced ? 0x3F : (light.dynamic_mask | light.drawn_dynamic_mask);
+		}
+	}
+
+	/*
+	call after scheduling with dirty_mask cleared on the lights held back, records the rest as drawn
+	*/
+	void commit(std::vector<PointLight>& lights, uint64_t static_version) {
+		for (PointLight& light : lights) {
+			if (light.dirty_mask != 0) {
+				light.drawn_static_version = static_version;
+				light.drawn_dynamic_mask = light.dynamic_mask;
+				light.drawn = true;
+			}
+			face_frames += 6;
+			for (uint32_t f = 0; f < 6; f++) {
+				face_redraws += (light.dirty_mask >> f) & 1;
+			}
+		}
+	}
+
+	/*
+	faces of light whose frustum the box reaches, 0 without testing the faces if the box is out of range
+	*/
+	static uint32_t face_mask(const PointLight& light, glm::vec3 bounds_min, glm::vec3 bounds_max) {
+		glm::vec3 closest = glm::clamp(light.pos, bounds_min, bounds_max);
+		if (glm::distance(closest, light.pos) > light.range) {
+			return 0;
+		}
+		uint32_t mask = 0;
+		for (uint32_t f = 0; f < 6; f++) {
+			mask |= ShadowAtlas::intersects(light.face_view_proj[f], bounds_min, bounds_max) ? 1u << f : 0;
+		}
+		return mask;
+	}
+
+	bool any_dirty(const std::vector<PointLight>& lights) const {
+		return std::any_of(lights.begin(), lights.end(), [](const PointLight& light) { return light.dirty_mask != 0; });
+	}
+
+	void reset_stats() {
+		frames = 0;
+		face_frames = 0;
+		face_redraws = 0;
+		casters = 0;
+		culled = 0;
+	}
+};
@@ -0,0 +1,157 @@
+#pragma once
+//GPU timing & pipeline statistics
+struct GpuZone {
+	std::string name;
+	uint32_t timestamp_query;		//begin, end is timestamp_query + 1
+	int32_t statistics_query;		//-1 if no statistics were gathered
+};
+
+struct GpuZoneResult {
+	std::string name;
+	float ms;
+	uint64_t fragment_invocations;
+	bool has_statistics;
+};
+
+struct GpuProfilerFrame {
+	VkQueryPool timestamps;
+	VkQueryPool statistics;
+	std::vector<GpuZone> zones;
+	uint32_t statistics_count;
+	bool recorded;
+};
+
+struct GpuProfiler {
+	static const uint32_t MAX_ZONES = 32;
+
+	std::vector<GpuProfilerFrame> frames;
+	float timestamp_period = 1.0f;		//ns per tick
+	bool statistics_enabled = false;
+	std::vector<GpuZoneResult> results;	//last resolved frame, in recording order
+	uint64_t resolved_count = 0;		//bumped whenever results are replaced
+
+	void init(VkDevice device, uint32_t frame_count, float period, bool statistics) {
+		timestamp_period = period;
+		statistics_enabled = statistics;
+		frames.resize(frame_count);
+
+		for (GpuProfilerFrame& frame : frames) {
+			VkQueryPoolCreateInfo timestamp_info = {};
+			timestamp_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			timestamp_info.pNext = nullptr;
+			timestamp_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			timestamp_info.queryCount = MAX_ZONES * 2;
+			VK_CHECK(vkCreateQueryPool(device, &timestamp_info, nullptr, &frame.timestamps));
+
+			frame.statistics = VK_NULL_HANDLE;
+			if (statistics_enabled) {
+				VkQueryPoolCreateInfo statistics_info = {};
+				statistics_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				statistics_info.pNext = nullptr;
+				statistics_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+				statistics_info.queryCount = MAX_ZONES;
+				statistics_info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+				VK_CHECK(vkCreateQueryPool(device, &statistics_info, nullptr, &frame.statistics));
+			}
+			frame.statistics_count = 0;
+			frame.recorded = false;
+		}
+	}
+
+	void destroy(VkDevice device) {
+		for (GpuProfilerFrame& frame : frames) {
+			vkDestroyQueryPool(device, frame.timestamps, nullptr);
+			if (frame.statistics != VK_NULL_HANDLE) {
+				vkDestroyQueryPool(device, frame.statistics, nullptr);
+			}
+		}
+		frames.clear();
+	}
+
+	/*
+	call once the frame's fence has signalled, before any zones are recorded
+	reads back the previous use of this frame's pools then resets them
+	*/
+	void begin_frame(VkDevice device, VkCommandBuffer cmd, uint32_t frame_index) {
+		GpuProfilerFrame& frame = frames.at(frame_index);
+
+		if (frame.recorded && !frame.zones.empty()) {
+			std::vector<uint64_t> ticks(frame.zones.size() * 2);
+			VkResult ts_res = vkGetQueryPoolResults(device, frame.timestamps, 0, (uint32_t)ticks.size(),
+				ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+			std::vector<uint64_t> invocations(frame.statistics_count);
+			VkResult stat_res = VK_NOT_READY;
+			if (frame.statistics_count > 0) {
+				stat_res = vkGetQueryPoolResults(device, frame.statistics, 0, frame.statistics_count,
+					invocations.size() * sizeof(uint64_t), invocations.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+			}
+
+			if (ts_res == VK_SUCCESS) {
+				results.clear();
+				for (size_t z = 0; z < frame.zones.size(); z++) {
+					const GpuZone& zone = frame.zones[z];
+					GpuZoneResult result = {};
+					result.name = zone.name;
+					result.ms = (float)(ticks[z * 2 + 1] - ticks[z * 2]) * timestamp_period / 1000000.0f;
+					result.has_statistics = zone.statistics_query >= 0 && stat_res == VK_SUCCESS;
+					result.fragment_invocations = result.has_statistics ? invocations[zone.statistics_query] : 0;
+					results.push_back(result);
+				}
+				resolved_count++;
+			}
+		}
+
+		vkCmdResetQueryPool(cmd, frame.timestamps, 0, MAX_ZONES * 2);
+		if (frame.statistics != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(cmd, frame.statistics, 0, MAX_ZONES);
+		}
+		frame.zones.clear();
+		frame.statistics_count = 0;
+		frame.recorded = true;
+	}
+
+	/*
+	returns the zone index to pass to end_zone, zones must not be nested inside a render pass they don't enclose
+	*/
+	uint32_t begin_zone(VkCommandBuffer cmd, uint32_t frame_index, const std::string& name, bool fragment_statistics = false) {
+		GpuProfilerFrame& frame = frames.at(frame_index);
+		if (frame.zones.size() >= MAX_ZONES) {
+			return UINT32_MAX;
+		}
+
+		GpuZone zone = {};
+		zone.name = name;
+		zone.timestamp_query = (uint32_t)frame.zones.size() * 2;
+		zone.statistics_query = -1;
+		if (fragment_statistics && statistics_enabled) {
+			zone.statistics_query = (int32_t)frame.statistics_count++;
+			vkCmdBeginQuery(cmd, frame.statistics, zone.statistics_query, 0);
+		}
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.timestamps, zone.timestamp_query);
+
+		frame.zones.push_back(zone);
+		return (uint32_t)frame.zones.size() - 1;
+	}
+
+	void end_zone(VkCommandBuffer cmd, uint32_t frame_index, uint32_t zone_index) {
+		GpuProfilerFrame& frame = frames.at(frame_index);
+		if (zone_index >= frame.zones.size()) {
+			return;
+		}
+		const GpuZone& zone = frame.zones[zone_index];
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame.timestamps, zone.timestamp_query + 1);
+		if (zone.statistics_query >= 0) {
+			vkCmdEndQuery(cmd, frame.statistics, zone.statistics_query);
+		}
+	}
+
+	const GpuZoneResult* find(const std::string& name) const {
+		for (const GpuZoneResult& result : results) {
+			if (result.name == name) {
+				return &result;
+			}
+		}
+		return nullptr;
+	}
+};
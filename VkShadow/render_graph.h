@@ -0,0 +1,333 @@
+#pragma once
+//Render graph
+enum RGUSAGE
+{
+	RG_COLOR_ATTACHMENT,
+	RG_DEPTH_ATTACHMENT,			//depth test & write
+	RG_DEPTH_ATTACHMENT_READ_ONLY,	//depth test without writes
+	RG_SAMPLED_FRAGMENT,
+	RG_SAMPLED_COMPUTE,
+	RG_STORAGE_COMPUTE,
+	RG_TRANSFER_SRC,
+	RG_TRANSFER_DST,
+	RG_PRESENT
+};
+
+struct RGImageState {
+	VkImageLayout layout;
+	VkPipelineStageFlags2 stage;
+	VkAccessFlags2 access;
+};
+
+struct RGResource {
+	std::string name;
+	VkImage image;
+	VkImageAspectFlags aspect;
+	RGImageState state;		//after the last compiled access, carried into the next frame
+	int32_t alias_group;	//resources in the same group share memory, -1 if none
+};
+
+struct RGAccess {
+	uint32_t resource;
+	RGUSAGE usage;
+	bool write;
+	bool discard;			//previous contents are not needed, transition from UNDEFINED
+};
+
+struct RGPass {
+	std::string name;
+	std::function<void(VkCommandBuffer)> record;
+	std::vector<RGAccess> accesses;
+	bool root;				//has side effects outside the graph (present), never culled
+	bool culled;
+	std::vector<VkImageMemoryBarrier2> barriers;	//issued as one vkCmdPipelineBarrier2 before record
+};
+
+/*
+passes declare which images they read and write and how
+compile() culls passes whose outputs never reach a root, then derives the exact
+layouts, stages and access masks between consecutive uses of every image
+*/
+struct RenderGraph {
+	std::vector<RGResource> resources;
+	std::vector<RGPass> passes;
+
+	static const VkAccessFlags2 WRITE_ACCESS =
+		VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+		VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+	static RGImageState usage_state(RGUSAGE usage) {
+		switch (usage)
+		{
+		case RG_COLOR_ATTACHMENT:
+			return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+				VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT };
+		case RG_DEPTH_ATTACHMENT:
+			return { VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT };
+		case RG_DEPTH_ATTACHMENT_READ_ONLY:
+			return { VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT };
+		case RG_SAMPLED_FRAGMENT:
+			return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT };
+		case RG_SAMPLED_COMPUTE:
+			return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT };
+		case RG_STORAGE_COMPUTE:
+			return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+				VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT };
+		case RG_TRANSFER_SRC:
+			return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT };
+		case RG_TRANSFER_DST:
+			return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT };
+		case RG_PRESENT:
+		default:
+			return { VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE };
+		}
+	}
+
+	static const char* usage_name(RGUSAGE usage) {
+		switch (usage)
+		{
+		case RG_COLOR_ATTACHMENT: return "color attachment";
+		case RG_DEPTH_ATTACHMENT: return "depth attachment";
+		case RG_DEPTH_ATTACHMENT_READ_ONLY: return "depth attachment (read only)";
+		case RG_SAMPLED_FRAGMENT: return "sampled (fragment)";
+		case RG_SAMPLED_COMPUTE: return "sampled (compute)";
+		case RG_STORAGE_COMPUTE: return "storage (compute)";
+		case RG_TRANSFER_SRC: return "transfer src";
+		case RG_TRANSFER_DST: return "transfer dst";
+		case RG_PRESENT: return "present";
+		default: return "unknown";
+		}
+	}
+
+	/*
+	images persist across frames, initial_state is what the first barrier waits on
+	*/
+	uint32_t add_resource(const std::string& name, VkImage image, VkImageAspectFlags aspect,
+		RGImageState initial_state = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE }) {
+		RGResource resource = {};
+		resource.name = name;
+		resource.image = image;
+		resource.aspect = aspect;
+		resource.state = initial_state;
+		resource.alias_group = -1;
+		resources.push_back(resource);
+		return (uint32_t)resources.size() - 1;
+	}
+
+	/*
+	rebinds an image whose handle or state changes between frames, e.g. the acquired swapchain image
+	*/
+	void set_image(uint32_t resource, VkImage image, RGImageState state) {
+		resources.at(resource).image = image;
+		resources.at(resource).state = state;
+	}
+
+	void set_alias_group(uint32_t resource, int32_t group) {
+		resources.at(resource).alias_group = group;
+	}
+
+	void reset() {
+		passes.clear();
+	}
+
+	uint32_t add_pass(const std::string& name, std::function<void(VkCommandBuffer)> record, bool root = false) {
+		RGPass pass = {};
+		pass.name = name;
+		pass.record = std::move(record);
+		pass.root = root;
+		pass.culled = false;
+		passes.push_back(std::move(pass));
+		return (uint32_t)passes.size() - 1;
+	}
+
+	void read(uint32_t pass, uint32_t resource, RGUSAGE usage) {
+		passes.at(pass).accesses.push_back({ resource, usage, false, false });
+	}
+
+	void write(uint32_t pass, uint32_t resource, RGUSAGE usage, bool discard = false) {
+		passes.at(pass).accesses.push_back({ resource, usage, true, discard });
+	}
+
+	void compile() {
+		cull();
+		build_barriers();
+	}
+
+	/*
+	walks back from the roots, a discarding write satisfies every later read of the resource
+	*/
+	void cull() {
+		std::vector<bool> needed(resources.size(), false);
+		for (size_t p = passes.size(); p-- > 0;) {
+			RGPass& pass = passes[p];
+			bool live = pass.root;
+			for (const RGAccess& access : pass.accesses) {
+				if (access.write && needed[access.resource]) {
+					live = true;
+				}
+			}
+			pass.culled = !live;
+			if (!live) {
+				continue;
+			}
+			for (const RGAccess& access : pass.accesses) {
+				needed[access.resource] = !(access.write && access.discard);
+			}
+		}
+	}
+
+	/*
+	first and last live pass touching resource, false if no live pass does
+	*/
+	bool lifetime(uint32_t resource, uint32_t& first, uint32_t& last) const {
+		bool found = false;
+		for (uint32_t p = 0; p < passes.size(); p++) {
+			if (passes[p].culled) {
+				continue;
+			}
+			for (const RGAccess& access : passes[p].accesses) {
+				if (access.resource == resource) {
+					first = found ? first : p;
+					last = p;
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
+
+	/*
+	read after read in the same layout only widens the stages later writers wait on
+	the first use of an aliased resource each frame also waits on the latest use of everything sharing its memory
+	*/
+	void build_barriers() {
+		std::vector<RGImageState> states(resources.size());
+		for (size_t r = 0; r < resources.size(); r++) {
+			states[r] = resources[r].state;
+		}
+		std::vector<bool> touched(resources.size(), false);
+
+		for (RGPass& pass : passes) {
+			pass.barriers.clear();
+			if (pass.culled) {
+				continue;
+			}
+			for (const RGAccess& access : pass.accesses) {
+				RGImageState& current = states[access.resource];
+				RGImageState next = usage_state(access.usage);
+
+				bool aliased_first_use = !touched[access.resource] && resources[access.resource].alias_group >= 0;
+				touched[access.resource] = true;
+				if (aliased_first_use) {
+					for (size_t other = 0; other < resources.size(); other++) {
+						if (other != access.resource && resources[other].alias_group == resources[access.resource].alias_group) {
+							current.stage |= states[other].stage;
+							current.access |= states[other].access & WRITE_ACCESS;
+						}
+					}
+					current.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+				}
+
+				bool current_writes = (current.access & WRITE_ACCESS) != 0;
+				if (!aliased_first_use && !access.write && !current_writes && !access.discard && current.layout == next.layout) {
+					current.stage |= next.stage;
+					current.access |= next.access;
+					continue;
+				}
+
+				VkImageMemoryBarrier2 barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+				barrier.pNext = nullptr;
+				barrier.srcStageMask = current.stage;
+				barrier.srcAccessMask = current.access & WRITE_ACCESS;
+				barrier.dstStageMask = next.stage;
+				barrier.dstAccessMask = next.access;
+				barrier.oldLayout = access.discard ? VK_IMAGE_LAYOUT_UNDEFINED : current.layout;
+				barrier.newLayout = next.layout;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = resources[access.resource].image;
+				barrier.subresourceRange.aspectMask = resources[access.resource].aspect;
+				barrier.subresourceRange.baseMipLevel = 0;
+				barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+				barrier.subresourceRange.baseArrayLayer = 0;
+				barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+				pass.barriers.push_back(barrier);
+
+				current = next;
+			}
+		}
+
+		for (size_t r = 0; r < resources.size(); r++) {
+			resources[r].state = states[r];
+		}
+	}
+
+	/*
+	returns the number of barriers issued
+	*/
+	uint32_t execute(VkCommandBuffer cmd) {
+		uint32_t barrier_count = 0;
+		for (RGPass& pass : passes) {
+			if (pass.culled) {
+				continue;
+			}
+			if (!pass.barriers.empty()) {
+				VkDependencyInfo dep_info = {};
+				dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+				dep_info.pNext = nullptr;
+				dep_info.imageMemoryBarrierCount = (uint32_t)pass.barriers.size();
+				dep_info.pImageMemoryBarriers = pass.barriers.data();
+				vkCmdPipelineBarrier2(cmd, &dep_info);
+				barrier_count += (uint32_t)pass.barriers.size();
+			}
+			if (pass.record) {
+				pass.record(cmd);
+			}
+		}
+		return barrier_count;
+	}
+
+	/*
+	pass names in order with culled passes marked, changes whenever the compiled graph does
+	*/
+	std::string signature() const {
+		std::string sig;
+		for (const RGPass& pass : passes) {
+			sig += (pass.culled ? "~" : "") + pass.name + ";";
+		}
+		return sig;
+	}
+
+	std::string dump() const {
+		std::ostringstream out;
+		out << "Render graph: " << passes.size() << " passes, " << resources.size() << " resources\n";
+		for (size_t p = 0; p < passes.size(); p++) {
+			const RGPass& pass = passes[p];
+			out << "  [" << p << "] " << pass.name << (pass.culled ? " (culled)" : "") << (pass.root ? " (root)" : "") << "\n";
+			for (const RGAccess& access : pass.accesses) {
+				out << "      " << (access.write ? "write " : "read  ") << resources[access.resource].name
+					<< " as " << usage_name(access.usage) << (access.discard ? ", discard" : "") << "\n";
+			}
+			for (const VkImageMemoryBarrier2& barrier : pass.barriers) {
+				std::string name = "?";
+				for (const RGResource& resource : resources) {
+					if (resource.image == barrier.image) {
+						name = resource.name;
+					}
+				}
+				out << "      barrier " << name << ": "
+					<< string_VkImageLayout(barrier.oldLayout) << " -> " << string_VkImageLayout(barrier.newLayout)
+					<< std::hex
+					<< " | stage 0x" << barrier.srcStageMask << " -> 0x" << barrier.dstStageMask
+					<< " | access 0x" << barrier.srcAccessMask << " -> 0x" << barrier.dstAccessMask
+					<< std::dec << "\n";
+			}
+		}
+		return out.str();
+	}
+};
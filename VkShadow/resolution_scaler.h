@@ -0,0 +1,74 @@
+#pragma once
+//Dynamic resolution
+/*
+scales the internal render extent to hold a GPU frame time budget
+GPU time is treated as proportional to pixel count, so the scale moves by the square root of budget / measured
+changes are damped and ignored inside a dead band so the extent doesn't oscillate frame to frame
+*/
+struct ResolutionScaler {
+	static const uint32_t HISTORY = 120;
+
+	bool enabled = false;
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+	float target_ms = 16.6f;
+	float headroom = 0.9f;		//aim under the budget so spikes don't immediately miss it
+	float damping = 0.15f;
+	float dead_band = 0.05f;
+
+	float scale = 1.0f;
+	float frame_ms[HISTORY] = {};
+	float scales[HISTORY] = {};
+	uint32_t samples = 0;
+
+	/*
+	feed the latest resolved GPU frame time, returns the scale to render the next frame at
+	*/
+	float update(float gpu_ms) {
+		frame_ms[samples % HISTORY] = gpu_ms;
+		scales[samples % HISTORY] = scale;
+		samples++;
+
+		if (!enabled) {
+			scale = max_scale;
+			return scale;
+		}
+		if (gpu_ms <= 0.0f) {
+			return scale;
+		}
+
+		float ratio = (target_ms * headroom) / gpu_ms;
+		if (std::abs(ratio - 1.0f) < dead_band) {
+			return scale;
+		}
+		float desired = std::clamp(scale * std::sqrt(ratio), min_scale, max_scale);
+		scale = std::clamp(scale + (desired - scale) * damping, min_scale, max_scale);
+		return scale;
+	}
+
+	/*
+	sub rectangle of max_extent to render into, rounded to 8 pixels
+	*/
+	VkExtent2D extent(VkExtent2D max_extent) const {
+		VkExtent2D scaled = {};
+		scaled.width = std::clamp(((uint32_t)(max_extent.width * scale) + 7) & ~7u, 8u, max_extent.width);
+		scaled.height = std::clamp(((uint32_t)(max_extent.height * scale) + 7) & ~7u, 8u, max_extent.height);
+		return scaled;
+	}
+
+	/*
+	min / average / max over the recorded history
+	*/
+	void summary(const float* values, float& lo, float& avg, float& hi) const {
+		uint32_t count = std::min(samples, HISTORY);
+		lo = count > 0 ? values[0] : 0.0f;
+		hi = lo;
+		avg = 0.0f;
+		for (uint32_t i = 0; i < count; i++) {
+			lo = std::min(lo, values[i]);
+			hi = std::max(hi, values[i]);
+			avg += values[i];
+		}
+		avg = count > 0 ? avg / count : 0.0f;
+	}
+};
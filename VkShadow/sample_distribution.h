@@ -0,0 +1,60 @@
+#pragma once
+//Sample distribution shadow maps
+/*
+a compute pass reduces depth_image to the nearest & farthest view depth actually visible after the geo pass
+each frame in flight reads back into its own buffer, read once that frame's fence has signalled, so the cascades
+are fit to depth seen frames_in_flight frames ago and the CPU never waits on the GPU for it
+the splits then only cover the visible range instead of camera near to shadow distance, the same texels over less depth
+the range is widened by a step & only moved by whole steps, so the cascades & shadow_cache stay still while the view does
+*/
+struct DepthBounds {
+	uint32_t min_bits;		//floatBitsToUint of view depth, positive floats order like their bits
+	uint32_t max_bits;
+};
+
+struct SampleDistribution {
+	bool enabled = true;
+	uint32_t steps = 32;			//the shadow distance is quantized into this many steps
+	float near_plane = 0.0f;		//fitted range, only used once fitted
+	float far_plane = 0.0f;
+	bool fitted = false;
+
+	//since the last report
+	uint32_t readbacks = 0;
+	uint32_t refits = 0;
+	double coverage_sum = 0.0;		//fitted range over the full range, summed per readback
+
+	/*
+	moves the fitted range to cover bounds, true when it moved
+	it grows as soon as visible depth leaves it but only shrinks once it is more than two steps too wide
+	*/
+	bool update(DepthBounds bounds, float camera_near, float camera_far) {
+		float min_depth = std::bit_cast<float>(bounds.min_bits);
+		float max_depth = std::bit_cast<float>(bounds.max_bits);
+		//nothing but background was drawn, keep what we have
+		if (!(min_depth <= max_depth)) {
+			return false;
+		}
+		float step = (camera_far - camera_near) / steps;
+		float lo = std::max(camera_near, camera_near + (std::floor((min_depth - camera_near) / step) - 1.0f) * step);
+		float hi = std::min(camera_far, camera_near + (std::ceil((max_depth - camera_near) / step) + 1.0f) * step);
+		hi = std::max(hi, lo + step);
+
+		readbacks++;
+		bool moved = !fitted || lo < near_plane || hi > far_plane || lo > near_plane + 2.0f * step || hi < far_plane - 2.0f * step;
+		if (moved) {
+			near_plane = lo;
+			far_plane = hi;
+			fitted = true;
+			refits++;
+		}
+		coverage_sum += (far_plane - near_plane) / (camera_far - camera_near);
+		return moved;
+	}
+
+	void reset_stats() {
+		readbacks = 0;
+		refits = 0;
+		coverage_sum = 0.0;
+	}
+};
@@ -0,0 +1,51 @@
+#pragma once
+//Shader variants
+/*
+an options struct baked into a shader as specialization constants, the driver strips branches on them
+every field is one 4 byte constant (uint32_t, float or VkBool32) and its constant_id is its field index
+*/
+template<typename Options>
+struct ShaderVariant {
+	static_assert(std::is_trivially_copyable_v<Options>, "options are copied as specialization data");
+	static_assert(sizeof(Options) % 4 == 0, "every option must be a 4 byte constant");
+	static const uint32_t CONSTANT_COUNT = sizeof(Options) / 4;
+
+	Options options = {};
+
+	std::vector<VkSpecializationMapEntry> map_entries() const {
+		std::vector<VkSpecializationMapEntry> entries(CONSTANT_COUNT);
+		for (uint32_t i = 0; i < CONSTANT_COUNT; i++) {
+			entries[i].constantID = i;
+			entries[i].offset = i * 4;
+			entries[i].size = 4;
+		}
+		return entries;
+	}
+
+	std::vector<uint8_t> data() const {
+		std::vector<uint8_t> bytes(sizeof(Options));
+		memcpy(bytes.data(), &options, sizeof(Options));
+		return bytes;
+	}
+
+	/*
+	identifies the variant, also part of the pipeline registry hash through the specialization data
+	*/
+	uint64_t key() const {
+		uint64_t hash = 0xcbf29ce484222325ull;
+		const uint8_t* bytes = (const uint8_t*)&options;
+		for (size_t i = 0; i < sizeof(Options); i++) {
+			hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+		}
+		return hash;
+	}
+
+	/*
+	specializes stage of desc with these options
+	*/
+	void specialize(PipelineDesc& desc, VkShaderStageFlagBits stage) const {
+		desc.spec_stage = stage;
+		desc.spec_entries = map_entries();
+		desc.spec_data = data();
+	}
+};
@@ -0,0 +1,224 @@
+#pragma once
+//Shadow atlas
+/*
+every shadowed spot light gets a square tile of one large depth texture, all tiles render in one pass
+tiles come from a quadtree, a node is split into 4 children when no free node of the wanted size is left
+tiles are reassigned whenever the camera moves, brightest on screen first, so the biggest tiles go to the
+lights covering the most of the view and a full atlas hands smaller tiles to the rest
+a tile is only redrawn when its light, its place in the atlas or the casters inside it changed
+begin_frame only marks what would be redrawn, commit records what the scheduler let through as drawn
+*/
+struct AtlasTile {
+	uint32_t x;
+	uint32_t y;
+	uint32_t size;		//0 when the light got no tile
+
+	bool operator==(const AtlasTile& other) const {
+		return x == other.x && y == other.y && size == other.size;
+	}
+};
+
+struct SpotLight {
+	glm::vec3 pos;
+	glm::vec3 dir;
+	glm::vec3 col;
+	float range;
+	float inner_angle;		//degrees from the axis, full intensity inside
+	float outer_angle;		//degrees from the axis, unlit outside
+	glm::mat4 view_proj;	//reversed Z perspective over the outer cone
+
+	//assigned by ShadowAtlas::assign
+	float importance;		//fraction of the screen height its range covers
+	AtlasTile tile;
+
+	//what the tile holds, see ShadowAtlas::begin_frame
+	AtlasTile drawn_tile;
+	glm::mat4 drawn_view_proj;
+	uint64_t drawn_static_version;
+	bool drawn_dynamic;		//a dynamic caster was inside the tile when it was drawn
+	bool dynamic;			//a dynamic caster is inside the tile this frame
+	bool forced;			//the tile holds no usable depth for this light or the static scene, it can't wait
+	bool dirty;
+};
+
+struct ShadowAtlas {
+	static const uint32_t LEVELS = 6;		//atlas down to atlas >> 5
+
+	uint32_t size = 4096;
+	uint32_t max_tile = 1024;
+	uint32_t min_tile = 128;
+	bool enabled = true;					//off redraws every tile every frame
+	std::vector<AtlasTile> free_tiles[LEVELS];		//free quadtree nodes of size >> level
+
+	//since the last report
+	uint32_t frames = 0;
+	uint32_t tile_frames = 0;
+	uint32_t tile_redraws = 0;
+
+	uint32_t level_of(uint32_t tile_size) const {
+		uint32_t level = 0;
+		while ((size >> level) > tile_size && level + 1 < LEVELS) {
+			level++;
+		}
+		return level;
+	}
+
+	void reset() {
+		for (std::vector<AtlasTile>& tiles : free_tiles) {
+			tiles.clear();
+		}
+		free_tiles[0].push_back({ 0, 0, size });
+	}
+
+	/*
+	a free node of tile_size, splitting the smallest larger node that is free, size 0 if the atlas is full
+	*/
+	AtlasTile allocate(uint32_t tile_size) {
+		uint32_t level = level_of(tile_size);
+		int32_t parent = (int32_t)level;
+		while (parent >= 0 && free_tiles[parent].empty()) {
+			parent--;
+		}
+		if (parent < 0) {
+			return { 0, 0, 0 };
+		}
+		for (uint32_t l = (uint32_t)parent; l < level; l++) {
+			AtlasTile node = free_tiles[l].back();
+			free_tiles[l].pop_back();
+			uint32_t half = node.size / 2;
+			//reversed so the top left child is handed out first
+			free_tiles[l + 1].push_back({ node.x + half, node.y + half, half });
+			free_tiles[l + 1].push_back({ node.x, node.y + half, half });
+			free_tiles[l + 1].push_back({ node.x + half, node.y, half });
+			free_tiles[l + 1].push_back({ node.x, node.y, half });
+		}
+		AtlasTile tile = free_tiles[level].back();
+		free_tiles[level].pop_back();
+		return tile;
+	}
+
+	/*
+	fraction of the screen height a light of range at pos covers, 0 when it is entirely behind the camera
+	*/
+	static float importance(glm::vec3 pos, float range, glm::vec3 eye, glm::vec3 forward, float tan_half_fov) {
+		glm::vec3 to_light = pos - eye;
+		float distance = glm::length(to_light);
+		bool visible = glm::dot(to_light, forward) > -range;
+		return visible ? std::min(range / (std::max(distance, range) * tan_half_fov), 1.0f) : 0.0f;
+	}
+
+	/*
+	rebuilds the quadtree from scratch, lights behind the camera or out of range get no tile
+	a light wanting a size that is gone falls back to smaller tiles
+	*/
+	void assign(std::vector<SpotLight>& lights, glm::vec3 eye, glm::vec3 forward, float tan_half_fov) {
+		std::vector<uint32_t> order;
+		for (uint32_t i = 0; i < lights.size(); i++) {
+			SpotLight& light = lights[i];
+			light.importance = importance(light.pos, light.range, eye, forward, tan_half_fov);
+			light.tile = { 0, 0, 0 };
+			if (light.importance > 0.0f) {
+				order.push_back(i);
+			}
+		}
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return lights[a].importance > lights[b].importance; });
+
+		reset();
+		for (uint32_t i : order) {
+			SpotLight& light = lights[i];
+			//a light over the whole screen asks for max_tile, half the screen for half of it
+			uint32_t wanted = std::clamp((uint32_t)(max_tile * light.importance), min_tile, max_tile);
+			for (uint32_t tile_size = size >> level_of(wanted); tile_size >= min_tile && light.tile.size == 0; tile_size /= 2) {
+				light.tile = allocate(tile_size);
+			}
+		}
+	}
+
+	/*
+	call once per recorded frame before scheduling, marks the tiles that would be redrawn
+	there is no static copy of a tile, one a dynamic caster reaches is redrawn whole, and again the frame after it leaves
+	*/
+	void begin_frame(std::vector<SpotLight>& lights, uint64_t static_version, const std::vector<DrawBatch>& batches) {
+		frames++;
+		for (SpotLight& light : lights) {
+			light.dynamic = false;
+			for (const DrawBatch& batch : batches) {
+				if (light.tile.size != 0 && batch.dynamic && intersects(light.view_proj, batch.bounds_min, batch.bounds_max)) {
+					light.dynamic = true;
+					break;
+				}
+			}
+			light.forced = light.tile.size != 0 && (!enabled || !(light.tile == light.drawn_tile) || light.view_proj != light.drawn_view_proj || static_version != light.drawn_static_version);
+			light.dirty = light.forced || (light.tile.size != 0 && (light.dynamic || light.drawn_dynamic));
+		}
+	}
+
+	/*
+	call after scheduling with dirty cleared on the tiles held back, records the rest as drawn
+	*/
+	void commit(std::vector<SpotLight>& lights, uint64_t static_version) {
+		for (SpotLight& light : lights) {
+			if (light.dirty) {
+				light.drawn_tile = light.tile;
+				light.drawn_view_proj = light.view_proj;
+				light.drawn_static_version = static_version;
+				light.drawn_dynamic = light.dynamic;
+			}
+			tile_frames += light.tile.size != 0 ? 1 : 0;
+			tile_redraws += light.dirty ? 1 : 0;
+		}
+	}
+
+	bool any_dirty(const std::vector<SpotLight>& lights) const {
+		return std::any_of(lights.begin(), lights.end(), [](const SpotLight& light) { return light.dirty; });
+	}
+
+	/*
+	conservative box test against a light's frustum, the box is only rejected when every corner is outside one plane
+	*/
+	static bool intersects(const glm::mat4& view_proj, glm::vec3 bounds_min, glm::vec3 bounds_max) {
+		glm::vec4 corners[8];
+		for (uint32_t c = 0; c < 8; c++) {
+			glm::vec3 corner = glm::vec3(c & 1 ? bounds_max.x : bounds_min.x, c & 2 ? bounds_max.y : bounds_min.y, c & 4 ? bounds_max.z : bounds_min.z);
+			corners[c] = view_proj * glm::vec4(corner, 1.0f);
+		}
+		//-w <= x <= w, -w <= y <= w, 0 <= z <= w
+		for (uint32_t plane = 0; plane < 6; plane++) {
+			bool outside = true;
+			for (const glm::vec4& p : corners) {
+				float d = 0.0f;
+				switch (plane) {
+				case 0: d = p.w + p.x; break;
+				case 1: d = p.w - p.x; break;
+				case 2: d = p.w + p.y; break;
+				case 3: d = p.w - p.y; break;
+				case 4: d = p.z; break;
+				default: d = p.w - p.z; break;
+				}
+				if (d >= 0.0f) {
+					outside = false;
+					break;
+				}
+			}
+			if (outside) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	float utilization() const {
+		uint64_t free_area = 0;
+		for (uint32_t level = 0; level < LEVELS; level++) {
+			uint64_t side = size >> level;
+			free_area += free_tiles[level].size() * side * side;
+		}
+		return 1.0f - (float)free_area / ((float)size * size);
+	}
+
+	void reset_stats() {
+		frames = 0;
+		tile_frames = 0;
+		tile_redraws = 0;
+	}
+};
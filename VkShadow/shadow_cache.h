@@ -0,0 +1,87 @@
+#pragma once
+//Shadow caching
+/*
+decides per frame which cascades of the shadow map actually have to be redrawn
+a cascade's static casters are only redrawn when its projection or the static scene changed since it was last drawn
+with no dynamic casters the shadow map is the cache and the pass is skipped outright when nothing is dirty
+with dynamic casters the static depth is kept in a separate cache image, copied into the shadow map each frame
+and only the dynamic casters are drawn on top
+*/
+struct ShadowCache {
+	bool enabled = true;
+	bool has_dynamic = false;		//this frame draws dynamic casters over a copy of the cache image
+	uint32_t dirty_mask = 0;		//cascades whose static casters are redrawn this frame
+
+	glm::mat4 drawn_view_proj[MAX_SHADOW_CASCADES] = {};
+	uint64_t drawn_static_version = 0;
+	bool drawn_dynamic = false;		//which image the static depth was last drawn into
+	bool valid = false;
+
+	//since the last report
+	uint32_t frames = 0;
+	uint32_t skipped_frames = 0;			//no shadow rendering at all
+	uint32_t cascade_frames = 0;			//cascades considered
+	uint32_t cascade_redraws = 0;			//cascades whose static casters were redrawn
+	uint32_t dynamic_frames = 0;
+
+	/*
+	true when begin_frame would redraw every cascade whatever their projections, holding any of them back gains nothing
+	*/
+	bool redraws_all(uint64_t static_version, bool dynamic_casters) const {
+		return !enabled || !valid || static_version != drawn_static_version || dynamic_casters != drawn_dynamic;
+	}
+
+	/*
+	call once per recorded frame before building the draw list, the redraw it decides on is recorded as done
+	*/
+	void begin_frame(const CascadedShadows& cascades, uint64_t static_version, bool dynamic_casters) {
+		uint32_t all = (1u << cascades.count) - 1;
+		has_dynamic = enabled && dynamic_casters;
+		if (!enabled) {
+			//every caster, every frame, straight into the shadow map
+			dirty_mask = all;
+			valid = false;
+		}
+		else if (redraws_all(static_version, has_dynamic)) {
+			//switching image also invalidates, the shadow map may hold dynamic casters & the cache image stale depth
+			dirty_mask = all;
+		}
+		else {
+			dirty_mask = 0;
+			for (uint32_t c = 0; c < cascades.count; c++) {
+				if (cascades.cascades[c].view_proj != drawn_view_proj[c]) {
+					dirty_mask |= 1u << c;
+				}
+			}
+		}
+
+		if (enabled) {
+			for (uint32_t c = 0; c < cascades.count; c++) {
+				drawn_view_proj[c] = cascades.cascades[c].view_proj;
+			}
+			drawn_static_version = static_version;
+			drawn_dynamic = has_dynamic;
+			valid = true;
+		}
+
+		frames++;
+		skipped_frames += (dirty_mask == 0 && !has_dynamic) ? 1 : 0;
+		cascade_frames += cascades.count;
+		for (uint32_t c = 0; c < cascades.count; c++) {
+			cascade_redraws += (dirty_mask >> c) & 1;
+		}
+		dynamic_frames += has_dynamic ? 1 : 0;
+	}
+
+	bool dirty(uint32_t cascade) const {
+		return (dirty_mask >> cascade) & 1;
+	}
+
+	void reset_stats() {
+		frames = 0;
+		skipped_frames = 0;
+		cascade_frames = 0;
+		cascade_redraws = 0;
+		dynamic_frames = 0;
+	}
+};
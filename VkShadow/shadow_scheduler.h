@@ -0,0 +1,166 @@
+#pragma once
+//Shadow update scheduling
+/*
+decides each frame which of the shadow views with a pending update are redrawn now and which keep their old depth
+a view is a cascade, a spot light's atlas tile or a point light's cube, it only asks when its cache has something to redraw
+each view gets an interval, the most frames its update may wait, from how much of the screen it covers & how fast it drifts
+near cascades & big lights update every frame, far cascades & distant lights every few frames
+updates that aren't due yet fill the per frame budget, most overdue first, and a view waiting for its first frame
+starts part way into its interval so views going stale on the same frame fall due on different frames
+views whose old depth would be wrong rather than just late (new tile, new static scene...) are forced through
+*/
+enum SHADOWVIEWTYPE
+{
+	VIEW_CASCADE,
+	VIEW_SPOT,
+	VIEW_POINT,
+	VIEW_TYPE_COUNT
+};
+
+struct ShadowView {
+	uint32_t type;
+	uint32_t index;			//cascade or light
+	uint32_t interval;		//frames the update may wait, 1 is every frame
+	float cost_ms;			//estimated GPU time of the redraw
+	bool forced;
+	bool scheduled;
+};
+
+struct ShadowScheduler {
+	static const uint32_t MAX_VIEWS = MAX_SHADOW_CASCADES + MAX_SPOT_LIGHTS + MAX_POINT_LIGHTS;
+
+	bool enabled = true;					//off redraws every pending view at once
+	float budget_ms = 1.0f;					//GPU time per frame for scheduled redraws
+	uint32_t max_interval = 8;
+	float max_drift = 0.1f;					//fraction of its radius a cascade may be left behind the camera
+	float ms_per_draw = 0.02f;				//running average of measured shadow pass time per draw
+	std::vector<ShadowView> requests;		//this frame's pending views
+	uint32_t waited[MAX_VIEWS] = {};		//frames each view's pending update has waited so far
+	bool pending[MAX_VIEWS] = {};			//asked last frame without being scheduled
+	uint32_t frame_views = 0;				//scheduled this frame
+	float frame_ms = 0.0f;					//this frame's estimate, fixed work included
+
+	//since the last report
+	uint32_t frames = 0;
+	uint32_t views_rendered[VIEW_TYPE_COUNT] = {};
+	uint32_t views_deferred = 0;
+	uint32_t over_budget_frames = 0;		//frames where fixed work, forced & due views alone went past the budget
+	double estimated_ms = 0.0;				//summed estimate of what was scheduled, fixed work included
+	double measured_ms = 0.0;				//summed shadow pass GPU time of resolved frames
+	uint32_t measured_frames = 0;
+
+	static uint32_t view_id(uint32_t type, uint32_t index) {
+		switch (type) {
+		case VIEW_CASCADE: return index;
+		case VIEW_SPOT: return MAX_SHADOW_CASCADES + index;
+		default: return MAX_SHADOW_CASCADES + MAX_SPOT_LIGHTS + index;
+		}
+	}
+
+	/*
+	1 for a view covering the screen, falling to max_interval as its importance falls
+	*/
+	uint32_t interval_for(float importance) const {
+		if (importance <= 0.0f) {
+			return max_interval;
+		}
+		return std::clamp((uint32_t)std::ceil(1.0f / importance), 1u, max_interval);
+	}
+
+	void begin_frame() {
+		requests.clear();
+	}
+
+	/*
+	queues a view with an update pending, draws is how many casters its redraw would record
+	*/
+	void request(uint32_t type, uint32_t index, uint32_t interval, uint32_t draws, bool forced) {
+		ShadowView view = {};
+		view.type = type;
+		view.index = index;
+		view.interval = std::clamp(interval, 1u, max_interval);
+		view.cost_ms = (float)(draws + 1) * ms_per_draw;
+		view.forced = forced || !enabled;
+		requests.push_back(view);
+	}
+
+	/*
+	picks this frame's redraws, fixed_ms is shadow work done every frame regardless (dynamic casters)
+	forced & due views always go, the rest in order of how far into their interval they are while the budget lasts
+	*/
+	void schedule(float fixed_ms) {
+		bool asked[MAX_VIEWS] = {};
+		for (ShadowView& view : requests) {
+			uint32_t id = view_id(view.type, view.index);
+			asked[id] = true;
+			if (!pending[id]) {
+				//staggered start, views of one interval going stale together spread over it
+				waited[id] = id % view.interval;
+			}
+		}
+		auto urgency = [&](const ShadowView& view) {
+			return view.forced ? 2.0f : (float)(waited[view_id(view.type, view.index)] + 1) / view.interval;
+		};
+		std::stable_sort(requests.begin(), requests.end(), [&](const ShadowView& a, const ShadowView& b) { return urgency(a) > urgency(b); });
+
+		float spent = fixed_ms;
+		frame_views = 0;
+		for (ShadowView& view : requests) {
+			uint32_t id = view_id(view.type, view.index);
+			bool due = urgency(view) >= 1.0f;
+			view.scheduled = due || spent + view.cost_ms <= budget_ms;
+			if (view.scheduled) {
+				spent += view.cost_ms;
+				views_rendered[view.type]++;
+				frame_views++;
+				waited[id] = 0;
+				pending[id] = false;
+			}
+			else {
+				waited[id]++;
+				pending[id] = true;
+				views_deferred++;
+			}
+		}
+		//views whose update went away, e.g. drawn by a forced redraw, start over next time
+		for (uint32_t id = 0; id < MAX_VIEWS; id++) {
+			if (!asked[id]) {
+				pending[id] = false;
+			}
+		}
+		frame_ms = spent;
+		estimated_ms += spent;
+		frames++;
+		over_budget_frames += spent > budget_ms ? 1 : 0;
+	}
+
+	bool scheduled(uint32_t type, uint32_t index) const {
+		for (const ShadowView& view : requests) {
+			if (view.type == type && view.index == index) {
+				return view.scheduled;
+			}
+		}
+		return false;
+	}
+
+	/*
+	measured shadow pass time of a resolved frame & the draws it recorded, refines the per draw cost
+	*/
+	void sample(float shadow_ms, uint32_t draws) {
+		measured_ms += shadow_ms;
+		measured_frames++;
+		if (draws > 0) {
+			ms_per_draw += 0.1f * (shadow_ms / draws - ms_per_draw);
+		}
+	}
+
+	void reset_stats() {
+		frames = 0;
+		std::fill(std::begin(views_rendered), std::end(views_rendered), 0);
+		views_deferred = 0;
+		over_budget_frames = 0;
+		estimated_ms = 0.0;
+		measured_ms = 0.0;
+		measured_frames = 0;
+	}
+};
@@ -0,0 +1,62 @@
+#pragma once
+//Worker threads
+struct ThreadPool {
+	std::vector<std::thread> threads;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable task_cv;
+	bool stopping = false;
+
+	void init(uint32_t thread_count) {
+		stopping = false;
+		for (uint32_t i = 0; i < thread_count; i++) {
+			threads.emplace_back([this]() { worker_loop(); });
+		}
+	}
+
+	/*
+	finishes queued tasks then joins every thread
+	*/
+	void shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		task_cv.notify_all();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		threads.clear();
+	}
+
+	uint32_t size() const {
+		return (uint32_t)threads.size();
+	}
+
+	std::future<void> submit(std::function<void()> task) {
+		auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+		std::future<void> future = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push([packaged]() { (*packaged)(); });
+		}
+		task_cv.notify_one();
+		return future;
+	}
+
+	void worker_loop() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				task_cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty()) {
+					return;
+				}
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+};
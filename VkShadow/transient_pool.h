@@ -0,0 +1,261 @@
+#pragma once
+//Transient render targets
+struct TransientImageDesc {
+	VkFormat format;
+	VkExtent3D extent;
+	VkImageUsageFlags usage;
+	VkImageAspectFlags aspect;
+};
+
+//pass range the image is live in this frame, images with disjoint ranges may share memory
+struct TransientRequest {
+	std::string name;
+	TransientImageDesc desc;
+	uint32_t first_pass;
+	uint32_t last_pass;
+};
+
+struct TransientImage {
+	ImageData data;
+	VkDeviceSize size;
+	int32_t block;		//memory block it is bound to, -1 if it owns lazily allocated memory
+	bool lazy;
+};
+
+struct TransientBlock {
+	VmaAllocation allocation;
+	VkMemoryRequirements requirements;
+	std::vector<uint32_t> members;
+};
+
+struct TransientPool {
+	std::vector<TransientRequest> requests;
+	std::vector<TransientImage> images;		//parallel to requests of the last build
+	std::vector<TransientBlock> blocks;
+	size_t built_hash = 0;
+	bool aliasing_enabled = true;
+
+	VkDeviceSize allocated_bytes = 0;		//memory actually backing the targets
+	VkDeviceSize requested_bytes = 0;		//what they would take without aliasing
+	VkDeviceSize peak_bytes = 0;			//highest allocated_bytes of any build
+	uint32_t lazy_count = 0;
+
+	void begin() {
+		requests.clear();
+	}
+
+	uint32_t request(const std::string& name, TransientImageDesc desc, uint32_t first_pass, uint32_t last_pass) {
+		requests.push_back({ name, desc, first_pass, last_pass });
+		return (uint32_t)requests.size() - 1;
+	}
+
+	static bool overlaps(const TransientRequest& a, const TransientRequest& b) {
+		return a.first_pass <= b.last_pass && b.first_pass <= a.last_pass;
+	}
+
+	static void hash_combine(size_t& seed, uint64_t value) {
+		seed ^= std::hash<uint64_t>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	}
+
+	/*
+	descriptions plus which pairs overlap, exact pass indices don't matter as long as the aliasing stays valid
+	*/
+	size_t hash_requests() const {
+		size_t seed = requests.size();
+		for (size_t i = 0; i < requests.size(); i++) {
+			const TransientImageDesc& d = requests[i].desc;
+			hash_combine(seed, d.format);
+			hash_combine(seed, ((uint64_t)d.extent.width << 32) | d.extent.height);
+			hash_combine(seed, d.extent.depth);
+			hash_combine(seed, d.usage);
+			hash_combine(seed, d.aspect);
+			for (size_t j = i + 1; j < requests.size(); j++) {
+				hash_combine(seed, overlaps(requests[i], requests[j]) ? 1 : 0);
+			}
+		}
+		hash_combine(seed, aliasing_enabled ? 1 : 0);
+		return seed;
+	}
+
+	bool needs_build() const {
+		return images.empty() || hash_requests() != built_hash;
+	}
+
+	/*
+	(re)creates every requested image if the frame description changed
+	attachment-only images use lazily allocated memory when the device has it, the rest are
+	packed first fit by size into shared blocks with every member's lifetime disjoint
+	the previous images must be retired first if frames in flight may still use them
+	*/
+	bool build(VkDevice device, VmaAllocator allocator) {
+		if (!needs_build()) {
+			return false;
+		}
+		destroy(device, allocator);
+
+		images.resize(requests.size());
+		std::vector<VkMemoryRequirements> requirements(requests.size());
+		allocated_bytes = 0;
+		requested_bytes = 0;
+		lazy_count = 0;
+
+		for (size_t i = 0; i < requests.size(); i++) {
+			const TransientImageDesc& desc = requests[i].desc;
+			TransientImage& target = images[i];
+			target = {};
+			target.data.format = desc.format;
+			target.data.extent = desc.extent;
+			target.block = -1;
+
+			VkImageCreateInfo img_info = {};
+			img_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			img_info.pNext = nullptr;
+			img_info.imageType = VK_IMAGE_TYPE_2D;
+			img_info.format = desc.format;
+			img_info.extent = desc.extent;
+			img_info.usage = desc.usage;
+			img_info.mipLevels = 1;
+			img_info.arrayLayers = 1;
+			img_info.samples = VK_SAMPLE_COUNT_1_BIT;
+			img_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+
+			VkImageUsageFlags attachment_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+			if ((desc.usage & ~attachment_usage) == 0) {
+				VkImageCreateInfo lazy_info = img_info;
+				lazy_info.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+				VmaAllocationCreateInfo lazy_alloc = {};
+				lazy_alloc.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+				uint32_t memory_type = 0;
+				if (vmaFindMemoryTypeIndexForImageInfo(allocator, &lazy_info, &lazy_alloc, &memory_type) == VK_SUCCESS) {
+					VK_CHECK(vmaCreateImage(allocator, &lazy_info, &lazy_alloc, &target.data.image, &target.data.allocation, nullptr));
+					target.lazy = true;
+					lazy_count++;
+				}
+			}
+			if (!target.lazy) {
+				VK_CHECK(vkCreateImage(device, &img_info, nullptr, &target.data.image));
+			}
+			vkGetImageMemoryRequirements(device, target.data.image, &requirements[i]);
+			target.size = requirements[i].size;
+			requested_bytes += target.size;
+		}
+
+		std::vector<uint32_t> order;
+		for (uint32_t i = 0; i < requests.size(); i++) {
+			if (!images[i].lazy) {
+				order.push_back(i);
+			}
+		}
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return images[a].size > images[b].size; });
+
+		for (uint32_t i : order) {
+			int32_t chosen = -1;
+			for (size_t b = 0; aliasing_enabled && b < blocks.size() && chosen < 0; b++) {
+				TransientBlock& block = blocks[b];
+				if ((block.requirements.memoryTypeBits & requirements[i].memoryTypeBits) == 0) {
+					continue;
+				}
+				bool disjoint = true;
+				for (uint32_t member : block.members) {
+					if (overlaps(requests[member], requests[i])) {
+						disjoint = false;
+						break;
+					}
+				}
+				if (disjoint) {
+					chosen = (int32_t)b;
+				}
+			}
+			if (chosen < 0) {
+				TransientBlock block = {};
+				block.requirements = requirements[i];
+				blocks.push_back(block);
+				chosen = (int32_t)blocks.size() - 1;
+			}
+
+			TransientBlock& block = blocks[chosen];
+			block.requirements.size = std::max(block.requirements.size, requirements[i].size);
+			block.requirements.alignment = std::max(block.requirements.alignment, requirements[i].alignment);
+			block.requirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+			block.members.push_back(i);
+			images[i].block = chosen;
+		}
+
+		for (TransientBlock& block : blocks) {
+			VmaAllocationCreateInfo alloc_info = {};
+			alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			VK_CHECK(vmaAllocateMemory(allocator, &block.requirements, &alloc_info, &block.allocation, nullptr));
+			allocated_bytes += block.requirements.size;
+
+			for (uint32_t member : block.members) {
+				VK_CHECK(vmaBindImageMemory(allocator, block.allocation, images[member].data.image));
+				images[member].data.allocation = block.allocation;
+			}
+		}
+
+		for (size_t i = 0; i < requests.size(); i++) {
+			ImageData& data = images[i].data;
+			VkImageViewCreateInfo view_info = {};
+			view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			view_info.pNext = nullptr;
+			view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			view_info.image = data.image;
+			view_info.format = data.format;
+			view_info.subresourceRange.baseMipLevel = 0;
+			view_info.subresourceRange.levelCount = 1;
+			view_info.subresourceRange.baseArrayLayer = 0;
+			view_info.subresourceRange.layerCount = 1;
+			view_info.subresourceRange.aspectMask = requests[i].desc.aspect;
+			VK_CHECK(vkCreateImageView(device, &view_info, nullptr, &data.view));
+		}
+
+		peak_bytes = std::max(peak_bytes, allocated_bytes);
+		built_hash = hash_requests();
+		return true;
+	}
+
+	/*
+	images sharing memory with another live image this frame, -1 if it has its memory to itself
+	*/
+	int32_t alias_group(uint32_t index) const {
+		int32_t block = images.at(index).block;
+		if (block < 0 || blocks[block].members.size() < 2) {
+			return -1;
+		}
+		return block;
+	}
+
+	/*
+	hands the current images & memory to the deletion queue, the next build starts empty
+	*/
+	void retire(DeletionQueue& deletion_queue, uint64_t frame) {
+		for (const TransientImage& target : images) {
+			deletion_queue.push_image_view(frame, target.data.view);
+			deletion_queue.push_image(frame, target.data.image, target.lazy ? target.data.allocation : VK_NULL_HANDLE);
+		}
+		for (const TransientBlock& block : blocks) {
+			deletion_queue.push_allocation(frame, block.allocation);
+		}
+		images.clear();
+		blocks.clear();
+	}
+
+	void destroy(VkDevice device, VmaAllocator allocator) {
+		for (const TransientImage& target : images) {
+			vkDestroyImageView(device, target.data.view, nullptr);
+			if (target.lazy) {
+				vmaDestroyImage(allocator, target.data.image, target.data.allocation);
+			}
+			else {
+				vkDestroyImage(device, target.data.image, nullptr);
+			}
+		}
+		for (const TransientBlock& block : blocks) {
+			vmaFreeMemory(allocator, block.allocation);
+		}
+		images.clear();
+		blocks.clear();
+		built_hash = 0;
+	}
+};
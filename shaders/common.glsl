@@ -0,0 +1,39 @@
+//shared by every shader reading the scene uniform buffer, matches common.h
+//limits & shadow layer layout
+const uint MAX_SHADOW_CASCADES = 4;
+const uint MAX_SPOT_LIGHTS = 32;
+const uint MAX_POINT_LIGHTS = 4;
+const uint POINT_LAYER_BASE = MAX_SHADOW_CASCADES + MAX_SPOT_LIGHTS;
+
+struct SpotLight {
+	mat4 view_proj;
+	vec4 position_range;
+	vec4 direction_cos_outer;
+	vec4 color_cos_inner;
+	vec4 atlas_rect;		//xy uv offset & zw uv scale of its tile, zw 0 when unshadowed
+};
+
+struct PointLight {
+	mat4 face_view_proj[6];		//+x -x +y -y +z -z
+	vec4 position_range;
+	vec4 color;
+};
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+	mat4 Q;
+	vec3 eye_pos;
+	mat4 cascade_view_proj[MAX_SHADOW_CASCADES];
+	vec4 cascade_splits;
+	vec4 cascade_params;
+	vec3 lightdir;
+	vec3 lightcol;
+	vec3 ka;
+	vec3 kd;
+	vec4 kss;
+	vec4 spot_params;		//x spot light count, y one atlas texel in uv
+	SpotLight spot_lights[MAX_SPOT_LIGHTS];
+	vec4 point_params;		//x point light count, y one cube face texel in uv
+	PointLight point_lights[MAX_POINT_LIGHTS];
+} ubo;
@@ -1,6 +1,14 @@
+if not exist spirv mkdir spirv
 
 %VULKAN_SDK%/Bin/glslc.exe mesh.frag -o spirv/mesh.frag.spv
 %VULKAN_SDK%/Bin/glslc.exe mesh.vert -o spirv/mesh.vert.spv
 %VULKAN_SDK%/Bin/glslc.exe shadow.frag -o spirv/shadow.frag.spv
-%VULKAN_SDK%/Bin/glslc.exe shadow.vert -o spirv/shadow.vert.spv
+%VULKAN_SDK%/Bin/glslc.exe point_shadow.frag -o spirv/point_shadow.frag.spv
+%VULKAN_SDK%/Bin/glslc.exe --target-env=vulkan1.2 shadow.vert -o spirv/shadow.vert.spv
+%VULKAN_SDK%/Bin/glslc.exe depth.vert -o spirv/depth.vert.spv
+%VULKAN_SDK%/Bin/glslc.exe tonemap.comp -o spirv/tonemap.comp.spv
+%VULKAN_SDK%/Bin/glslc.exe moments_blur.comp -o spirv/moments_blur.comp.spv
+%VULKAN_SDK%/Bin/glslc.exe depth_reduce.comp -o spirv/depth_reduce.comp.spv
+
+for %%f in (spirv\*.spv) do %VULKAN_SDK%/Bin/spirv-val.exe --target-env vulkan1.3 %%f
 pause
\ No newline at end of file
@@ -0,0 +1,36 @@
+#version 450
+#extension GL_EXT_buffer_reference : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
+
+struct Vertex {
+	vec3 position;
+	float uv_x;
+	vec3 col;
+	float uv_y;
+	vec3 normal;
+}; 
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
+	Vertex vertices[];
+};
+
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	mat4 models[];
+};
+
+layout( push_constant ) uniform constants{
+	VertexBuffer vertex_buffer;
+	InstanceBuffer instance_buffer;
+} pc;
+
+//must match mesh.vert bit for bit so the colour pass can depth test with EQUAL
+invariant gl_Position;
+
+void main() 
+{	
+	Vertex v = pc.vertex_buffer.vertices[gl_VertexIndex];
+	mat4 model = pc.instance_buffer.models[gl_InstanceIndex];
+	gl_Position =  ubo.proj * ubo.view * model * vec4(v.position, 1.0f);
+}
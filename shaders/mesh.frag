@@ -1,56 +1,330 @@
 #version 450
-layout (binding = 0) uniform UniformBufferObject {
-    mat4 view;
-    mat4 proj;
-	mat4 Q;
-	mat4 lightview;
-	mat4 lightproj;
-	vec3 lightpos_world;
-	vec3 lightcol;
-	vec3 ka;
-	vec3 kd;
-	vec4 kss;
-} ubo;
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
 
 layout (binding = 1) uniform sampler _sampler;
-layout (binding = 2) uniform texture2D _depth_texture;
+layout (binding = 2) uniform texture2DArray _depth_texture;		//a layer per cascade
+layout (binding = 3) uniform sampler _compare_sampler;			//depth compare, linear so each tap is a 2x2 PCF
+layout (binding = 4) uniform texture2DArray _moments_texture;	//EVSM moments, blurred & mipmapped
+layout (binding = 5) uniform sampler _moments_sampler;			//trilinear & anisotropic
+layout (binding = 6) uniform texture2D _atlas_texture;			//spot light depth, a tile per shadowed light
+layout (binding = 7) uniform textureCubeArray _point_texture;	//point light distance, a cube per light
 
 layout (location = 0) in vec3  worldNorm;
 layout (location = 1) in vec4 worldPos;
-layout (location = 2) in vec4 lightPos;
 
 layout (location = 0) out vec4 outFragColor;
 
+//specialization constants, ids match the field order of MeshShadingOptions
+const uint SHADOW_OFF = 0;
+const uint SHADOW_HARD = 1;
+const uint SHADOW_PCF = 2;
+const uint SHADOW_POISSON = 3;
+const uint SHADOW_PCSS = 4;
+const uint SHADOW_EVSM = 5;
+const uint LIGHTING_PHONG = 0;
+const uint LIGHTING_DIFFUSE = 1;
+const uint LIGHTING_NORMALS = 2;
+const uint LIGHTING_CASCADES = 3;
+
+layout (constant_id = 0) const uint SHADOW_MODE = SHADOW_HARD;
+layout (constant_id = 1) const bool BORDER_BYPASS = true;	//treat the edge of the shadowmap as lit
+layout (constant_id = 2) const float DEPTH_BIAS = 0.001;
+layout (constant_id = 3) const uint LIGHTING_MODE = LIGHTING_PHONG;
+layout (constant_id = 4) const bool CASCADE_BLEND = true;		//fade into the next cascade before its split
+layout (constant_id = 5) const uint FILTER_TAPS = 16;			//Poisson taps, up to 32
+layout (constant_id = 6) const float FILTER_RADIUS = 1.5;		//Poisson disk radius in shadow texels
+layout (constant_id = 7) const uint BLOCKER_TAPS = 8;			//PCSS blocker search gathers, 4 texels each
+layout (constant_id = 8) const float LIGHT_SIZE = 0.02;		//PCSS, tangent of the sun's angular radius
+layout (constant_id = 9) const float EVSM_EXPONENT = 5.0;		//matches the warp in moments_blur.comp
+layout (constant_id = 10) const float LIGHT_BLEED = 0.2;		//EVSM, fraction of the Chebyshev bound cut off
+
+const vec3 cascade_tints[MAX_SHADOW_CASCADES] = vec3[](vec3(1.0, 0.5, 0.5), vec3(0.5, 1.0, 0.5), vec3(0.5, 0.5, 1.0), vec3(1.0, 1.0, 0.5));
+
+//ordered so every prefix is spread over the disk, the first 4 sit on its rim
+const uint MAX_TAPS = 32;
+const vec2 poisson_disk[MAX_TAPS] = vec2[](
+	vec2(0.9746, -0.2191), vec2(-0.9371, 0.2799), vec2(-0.1842, -0.9699), vec2(0.3364, 0.8740),
+	vec2(-0.0853, 0.1030), vec2(-0.4022, 0.9088), vec2(0.4989, -0.8446), vec2(-0.7375, -0.6475),
+	vec2(0.8618, 0.3870), vec2(0.1957, -0.4860), vec2(0.2728, 0.4140), vec2(-0.9380, -0.1742),
+	vec2(-0.5355, 0.4084), vec2(-0.1538, -0.3067), vec2(0.6645, 0.0532), vec2(-0.5421, -0.3148),
+	vec2(0.2695, -0.1092), vec2(0.7873, -0.6015), vec2(-0.0203, 0.9492), vec2(0.5994, -0.3019),
+	vec2(0.6386, 0.7280), vec2(0.1451, -0.9872), vec2(-0.3523, -0.6983), vec2(0.0367, 0.6384),
+	vec2(-0.2565, 0.5225), vec2(0.9952, 0.0802), vec2(-0.7077, 0.6530), vec2(0.0150, -0.7117),
+	vec2(0.5489, 0.3509), vec2(-0.3644, -0.0977), vec2(0.5168, -0.5610), vec2(-0.5668, 0.1390)
+);
+
+//screen space derivatives of worldPos, taken in main where control flow is uniform
+vec4 world_dx;
+vec4 world_dy;
+
+//xy shadow uv & z depth of this pixel in cascade c
+vec3 shadow_coord(uint c) {
+	vec4 light_clip = ubo.cascade_view_proj[c] * worldPos;
+	vec3 pixel_light_ndc = light_clip.xyz / light_clip.w;
+	return vec3(pixel_light_ndc.xy * 0.5 + 0.5, pixel_light_ndc.z);
+}
+
+//1 lit, 0 shadowed, one manual compare
+float shadow_hard(uint c, vec3 coord) {
+	float sampled_depth = texture(sampler2DArray(_depth_texture, _sampler), vec3(coord.xy, float(c))).x;
+	return coord.z + DEPTH_BIAS > sampled_depth ? 1.0 : 0.0;
+}
+
+//fraction lit of the 2x2 texels around uv, compared & filtered by the sampler in one fetch
+float shadow_pcf(uint c, vec2 uv, float depth) {
+	return texture(sampler2DArrayShadow(_depth_texture, _compare_sampler), vec4(uv, float(c), depth + DEPTH_BIAS));
+}
+
+//per pixel rotation of the disk, interleaved gradient noise turns banding into fine noise
+mat2 tap_rotation() {
+	float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+	float s = sin(angle);
+	float co = cos(angle);
+	return mat2(co, s, -s, co);
+}
+
+//rotated Poisson disk of PCF taps, the 4 rim taps answer alone when they agree the pixel is fully lit or shadowed
+float shadow_poisson(uint c, vec3 coord, float uv_radius) {
+	mat2 rotation = tap_rotation();
+	uint taps = min(FILTER_TAPS, MAX_TAPS);
+	uint rim_taps = min(taps, 4u);
+	float lit = 0.0;
+	for (uint i = 0; i < rim_taps; i++) {
+		lit += shadow_pcf(c, coord.xy + rotation * poisson_disk[i] * uv_radius, coord.z);
+	}
+	if (taps == rim_taps || lit == 0.0 || lit == float(rim_taps)) {
+		return lit / float(rim_taps);
+	}
+	for (uint i = rim_taps; i < taps; i++) {
+		lit += shadow_pcf(c, coord.xy + rotation * poisson_disk[i] * uv_radius, coord.z);
+	}
+	return lit / float(taps);
+}
+
+//mean depth of the texels nearer the sun than the receiver within uv_radius, -1 if there are none
+float find_blockers(uint c, vec3 coord, float uv_radius) {
+	mat2 rotation = tap_rotation();
+	uint taps = min(BLOCKER_TAPS, MAX_TAPS);
+	float depth_sum = 0.0;
+	float blockers = 0.0;
+	for (uint i = 0; i < taps; i++) {
+		vec2 uv = coord.xy + rotation * poisson_disk[i] * uv_radius;
+		vec4 depths = textureGather(sampler2DArray(_depth_texture, _sampler), vec3(uv, float(c)));
+		//reversed Z, blockers are deeper
+		vec4 blocking = step(vec4(coord.z + DEPTH_BIAS), depths);
+		depth_sum += dot(depths, blocking);
+		blockers += dot(blocking, vec4(1.0));
+	}
+	return blockers > 0.0 ? depth_sum / blockers : -1.0;
+}
+
+//percentage closer soft shadows, the blocker distance scales the Poisson disk to the sun's penumbra
+float shadow_pcss(uint c, vec3 coord, float texel) {
+	//orthographic, uv & depth change linearly with world distance across & along the light
+	mat4 m = ubo.cascade_view_proj[c];
+	float uv_per_world = 0.5 * length(vec3(m[0][0], m[1][0], m[2][0]));
+	float depth_per_world = length(vec3(m[0][2], m[1][2], m[2][2]));
+
+	//blockers up to the top of the projection can reach, kept local so the search stays cheap
+	float search_radius = min(LIGHT_SIZE * (1.0 - coord.z) / depth_per_world * uv_per_world, 16.0 * texel);
+	float blocker_depth = find_blockers(c, coord, max(search_radius, texel));
+	if (blocker_depth < 0.0) {
+		return 1.0;
+	}
+	float penumbra = LIGHT_SIZE * (blocker_depth - coord.z) / depth_per_world * uv_per_world;
+	return shadow_poisson(c, coord, clamp(penumbra, texel, 16.0 * texel));
+}
+
+//upper bound on the fraction lit from the mean & variance of one warp
+float chebyshev(vec2 moments, float mean, float min_variance) {
+	float variance = max(moments.y - moments.x * moments.x, min_variance);
+	float d = mean - moments.x;
+	float p_max = variance / (variance + d * d);
+	//light bleeding reduction, the low tail of the bound is treated as shadowed
+	p_max = clamp((p_max - LIGHT_BLEED) / (1.0 - LIGHT_BLEED), 0.0, 1.0);
+	return mean <= moments.x ? 1.0 : p_max;
+}
+
+//exponential variance shadow map, one trilinear anisotropic fetch of prefiltered moments
+float shadow_evsm(uint c, vec3 coord) {
+	//orthographic, w stays 1 so the uv gradients are the projected world gradients
+	mat4 m = ubo.cascade_view_proj[c];
+	vec2 uv_dx = 0.5 * (m * world_dx).xy;
+	vec2 uv_dy = 0.5 * (m * world_dy).xy;
+	vec4 moments = textureGrad(sampler2DArray(_moments_texture, _moments_sampler), vec3(coord.xy, float(c)), uv_dx, uv_dy);
+
+	//moments hold distance from the sun, reversed Z depth is flipped the same way
+	float d = 2.0 * (1.0 - coord.z - DEPTH_BIAS) - 1.0;
+	vec2 warped = vec2(exp(EVSM_EXPONENT * d), -exp(-EVSM_EXPONENT * d));
+	vec2 depth_scale = 0.0001 * EVSM_EXPONENT * warped;
+	vec2 min_variance = depth_scale * depth_scale;
+	return min(chebyshev(moments.xy, warped.x, min_variance.x), chebyshev(moments.zw, warped.y, min_variance.y));
+}
+
+//1 lit, 0 shadowed by cascade c, filtered by SHADOW_MODE
+float shadow(uint c) {
+	vec3 coord = shadow_coord(c);
+	if (BORDER_BYPASS && (coord.x < 0.01 || coord.x > 0.99 || coord.y < 0.01 || coord.y > 0.99)) {
+		return 1.0;
+	}
+	float texel = 1.0 / float(textureSize(sampler2DArray(_depth_texture, _sampler), 0).x);
+	if (SHADOW_MODE == SHADOW_PCF) {
+		return shadow_pcf(c, coord.xy, coord.z);
+	}
+	if (SHADOW_MODE == SHADOW_POISSON) {
+		return shadow_poisson(c, coord, FILTER_RADIUS * texel);
+	}
+	if (SHADOW_MODE == SHADOW_PCSS) {
+		return shadow_pcss(c, coord, texel);
+	}
+	if (SHADOW_MODE == SHADOW_EVSM) {
+		return shadow_evsm(c, coord);
+	}
+	return shadow_hard(c, coord);
+}
+
+//1 lit, 0 shadowed by spot light i, one PCF tap inside its atlas tile
+float spot_shadow(uint i, vec3 N, float dist) {
+	vec4 rect = ubo.spot_lights[i].atlas_rect;
+	if (SHADOW_MODE == SHADOW_OFF || rect.z == 0.0) {
+		return 1.0;
+	}
+	//perspective, a shadow texel widens with distance, the receiver is pushed out along its normal by about one
+	float texel = ubo.spot_params.y;
+	float cos_outer = ubo.spot_lights[i].direction_cos_outer.w;
+	float tan_outer = sqrt(1.0 - cos_outer * cos_outer) / cos_outer;
+	float world_texel = 2.0 * dist * tan_outer * texel / rect.z;
+	vec4 light_clip = ubo.spot_lights[i].view_proj * vec4(worldPos.xyz + N * 1.5 * world_texel, 1.0);
+	vec3 ndc = light_clip.xyz / light_clip.w;
+
+	//clamped half a texel inside the tile so the filter never reads a neighbour
+	vec2 uv = clamp(ndc.xy * 0.5 + 0.5, vec2(0.5 * texel / rect.z), vec2(1.0 - 0.5 * texel / rect.z));
+	return texture(sampler2DShadow(_atlas_texture, _compare_sampler), vec3(rect.xy + uv * rect.zw, ndc.z));
+}
+
+//1 lit, 0 shadowed by point light i, one PCF tap of its cube
+float point_shadow(uint i, vec3 N, float dist) {
+	if (SHADOW_MODE == SHADOW_OFF) {
+		return 1.0;
+	}
+	//a face spans 90 degrees so one of its texels is about 2 * dist / resolution wide, pushed out by 1.5 of them
+	float world_texel = 2.0 * dist * ubo.point_params.y;
+	vec3 from_light = worldPos.xyz + N * 1.5 * world_texel - ubo.point_lights[i].position_range.xyz;
+	float range = ubo.point_lights[i].position_range.w;
+	return texture(samplerCubeArrayShadow(_point_texture, _compare_sampler), vec4(from_light, float(i)), 1.0 - length(from_light) / range);
+}
+
+//diffuse & Phong reflection of a local light, radiance carries its falloff
+vec3 local_direct(vec3 N, vec3 V, vec3 Li, float NdotL) {
+	vec3 direct = ubo.kd * NdotL;
+	if (LIGHTING_MODE == LIGHTING_PHONG || LIGHTING_MODE == LIGHTING_CASCADES) {
+		vec3 Ri = normalize(2 * N * NdotL - Li);
+		direct += vec3(ubo.kss) * pow(max(0, dot(Ri, V)), ubo.kss.w);
+	}
+	return direct;
+}
+
+//every spot light in range, smooth cone edge & windowed inverse square falloff
+vec3 spot_lighting(vec3 N, vec3 V) {
+	vec3 result = vec3(0.0);
+	uint count = uint(ubo.spot_params.x);
+	for (uint i = 0; i < count; i++) {
+		vec3 to_light = ubo.spot_lights[i].position_range.xyz - worldPos.xyz;
+		float dist = length(to_light);
+		float range = ubo.spot_lights[i].position_range.w;
+		if (dist >= range) {
+			continue;
+		}
+		vec3 Li = to_light / dist;
+		float cone = smoothstep(ubo.spot_lights[i].direction_cos_outer.w, ubo.spot_lights[i].color_cos_inner.w, dot(-Li, ubo.spot_lights[i].direction_cos_outer.xyz));
+		float NdotL = dot(N, Li);
+		if (cone <= 0.0 || NdotL <= 0.0) {
+			continue;
+		}
+		float window = 1.0 - (dist * dist) / (range * range);
+		vec3 radiance = ubo.spot_lights[i].color_cos_inner.rgb * cone * window * window;
+		result += radiance * local_direct(N, V, Li, NdotL) * spot_shadow(i, N, dist);
+	}
+	return result;
+}
+
+//every point light in range, same falloff as the spot lights without the cone
+vec3 point_lighting(vec3 N, vec3 V) {
+	vec3 result = vec3(0.0);
+	uint count = uint(ubo.point_params.x);
+	for (uint i = 0; i < count; i++) {
+		vec3 to_light = ubo.point_lights[i].position_range.xyz - worldPos.xyz;
+		float dist = length(to_light);
+		float range = ubo.point_lights[i].position_range.w;
+		if (dist >= range) {
+			continue;
+		}
+		vec3 Li = to_light / dist;
+		float NdotL = dot(N, Li);
+		if (NdotL <= 0.0) {
+			continue;
+		}
+		float window = 1.0 - (dist * dist) / (range * range);
+		vec3 radiance = ubo.point_lights[i].color.rgb * window * window;
+		result += radiance * local_direct(N, V, Li, NdotL) * point_shadow(i, N, dist);
+	}
+	return result;
+}
+
 void main() 
 {	
-	vec3 pixel_light_ndc = lightPos.xyz / lightPos.w;
-	float pixel_depth = pixel_light_ndc.z;
-	float sampled_depth = texture(sampler2D(_depth_texture, _sampler), (pixel_light_ndc.xy * 0.5 + 0.5)).x;
-	float bias = 0.001;
+	vec3 N = normalize(worldNorm);
+	if (LIGHTING_MODE == LIGHTING_NORMALS) {
+		outFragColor = vec4(N * 0.5 + 0.5, 1.0f);
+		return;
+	}
 
+	world_dx = dFdx(worldPos);
+	world_dy = dFdy(worldPos);
 
-	bool bypass = false;
-	vec2 bypassTest = vec2(pixel_light_ndc.x * 0.5 + 0.5, pixel_light_ndc.y * 0.5 + 0.5);
-	if(bypassTest.x < 0.01 || bypassTest.x > 0.99 || bypassTest.y < 0.01 || bypassTest.y > 0.99){
-		bypass = true;	
+	//first cascade whose split is past this pixel's view depth
+	float view_depth = -(ubo.view * worldPos).z;
+	uint cascade_count = uint(ubo.cascade_params.x);
+	uint cascade = 0;
+	while (cascade + 1 < cascade_count && view_depth > ubo.cascade_splits[cascade]) {
+		cascade++;
 	}
-	
-	vec3 currColor = ubo.ka;
-	 if(pixel_depth + bias > sampled_depth || bypass){
-		vec3 eye = vec3(0.0f, 2.0f, 2.0f); 
-		vec3 pos = vec3(worldPos);
-		vec3 N = normalize(worldNorm);
 
-		vec3 ks = vec3(ubo.kss);
-		float s = ubo.kss.w;
+	float lit = 1.0;
+	if (SHADOW_MODE != SHADOW_OFF) {
+		lit = shadow(cascade);
+		if (CASCADE_BLEND && cascade + 1 < cascade_count) {
+			float split_near = cascade == 0 ? ubo.cascade_params.z : ubo.cascade_splits[cascade - 1];
+			float band = (ubo.cascade_splits[cascade] - split_near) * ubo.cascade_params.y;
+			float t = (view_depth - (ubo.cascade_splits[cascade] - band)) / band;
+			if (t > 0.0) {
+				lit = mix(lit, shadow(cascade + 1), clamp(t, 0.0, 1.0));
+			}
+		}
+	}
 
-		vec3 Li =  normalize(ubo.lightpos_world - pos);
-		vec3 Ri = normalize(2 * N * dot(Li, N) - Li);
+	vec3 currColor = ubo.ka;
+	if (lit > 0.0) {
+		vec3 pos = vec3(worldPos);
+		vec3 Li = normalize(ubo.lightdir);
+		vec3 direct = ubo.lightcol * ubo.kd * max(0, dot(Li, N));
 
-		vec3 kd_vec = ubo.kd * max(0, dot(Li, N));
-		vec3 ks_vec = ks * pow(max(0, dot(Ri, normalize(eye))),s);
-		currColor += ubo.lightcol * ks_vec;
-		currColor += ubo.lightcol * kd_vec;
-	 }
+		if (LIGHTING_MODE == LIGHTING_PHONG || LIGHTING_MODE == LIGHTING_CASCADES) {
+			vec3 V = normalize(ubo.eye_pos - pos);
+			vec3 Ri = normalize(2 * N * dot(Li, N) - Li);
+			vec3 ks = vec3(ubo.kss);
+			float s = ubo.kss.w;
+			direct += ubo.lightcol * ks * pow(max(0, dot(Ri, V)), s);
+		}
+		currColor += direct * lit;
+	}
+	vec3 V = normalize(ubo.eye_pos - vec3(worldPos));
+	currColor += spot_lighting(N, V);
+	currColor += point_lighting(N, V);
+	if (LIGHTING_MODE == LIGHTING_CASCADES) {
+		currColor *= cascade_tints[cascade];
+	}
 	outFragColor = vec4(currColor,1.0f);
 }
@@ -1,22 +1,11 @@
 #version 450
 #extension GL_EXT_buffer_reference : require
+#extension GL_GOOGLE_include_directive : require
 
-layout(binding = 0) uniform UniformBufferObject {
-    mat4 view;
-    mat4 proj;
-	mat4 Q;
-	mat4 lightview;
-	mat4 lightproj;
-	vec3 lightpos;	
-	vec3 lightcol;
-	vec3 ka;
-	vec3 kd;
-	vec4 kss;
-} ubo;
+#include "common.glsl"
 
 layout (location = 0) out vec3 worldNorm;
 layout (location = 1) out vec4 worldPos;
-layout (location = 2) out vec4 lightPos;
 
 struct Vertex {
 	vec3 position;
@@ -30,18 +19,24 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer{
 	Vertex vertices[];
 };
 
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	mat4 models[];
+};
+
 layout( push_constant ) uniform constants{
-	mat4 model;
 	VertexBuffer vertex_buffer;
+	InstanceBuffer instance_buffer;
 } pc;
 
+invariant gl_Position;
+
 void main() 
 {	
 	Vertex v = pc.vertex_buffer.vertices[gl_VertexIndex];
-	gl_Position =  ubo.proj * ubo.view * pc.model * vec4(v.position, 1.0f);
+	mat4 model = pc.instance_buffer.models[gl_InstanceIndex];
+	gl_Position =  ubo.proj * ubo.view * model * vec4(v.position, 1.0f);
 	
 	worldNorm = normalize(vec3(ubo.Q * vec4(v.normal, 1.0f)));
 	//worldNorm = v.normal;
-	worldPos = pc.model * vec4(v.position, 1.0f);
-	lightPos = ubo.lightproj * ubo.lightview * pc.model * vec4(v.position, 1.0);
+	worldPos = model * vec4(v.position, 1.0f);
 }
@@ -0,0 +1,9 @@
+#version 450
+
+layout (location = 0) in vec4 light_offset;		//xyz from the light, w its range
+
+//linear distance, reversed like every other depth so the light is 1 and its range 0
+void main()
+{
+	gl_FragDepth = 1.0 - length(light_offset.xyz) / light_offset.w;
+}
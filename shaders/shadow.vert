@@ -1,18 +1,9 @@
 #version 450
 #extension GL_EXT_buffer_reference : require
+#extension GL_ARB_shader_viewport_layer_array : require
+#extension GL_GOOGLE_include_directive : require
 
-layout(binding = 0) uniform UniformBufferObject {
-    mat4 view;
-    mat4 proj;
-	mat4 Q;
-	mat4 lightview;
-	mat4 lightproj;
-	vec3 lightpos;	
-	vec3 lightcol;
-	vec3 ka;
-	vec3 kd;
-	vec4 kss;
-} ubo;
+#include "common.glsl"
 
 struct Vertex {
 	vec3 position;
@@ -26,13 +17,41 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer{
 	Vertex vertices[];
 };
 
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	mat4 models[];
+};
+
+//world space offset from the point light & its range, only read by point_shadow.frag
+layout (location = 0) out vec4 light_offset;
+
 layout( push_constant ) uniform constants{
-	mat4 model;
 	VertexBuffer vertex_buffer;
+	InstanceBuffer instance_buffer;
+	uint layer;
 } pc;
 
 void main() 
 {	
 	Vertex v = pc.vertex_buffer.vertices[gl_VertexIndex];
-	gl_Position =  ubo.lightproj * ubo.lightview * pc.model * vec4(v.position, 1.0f);
+	mat4 model = pc.instance_buffer.models[gl_InstanceIndex];
+	//every cascade is a layer of the shadowmap, the CPU only issues draws for cascades a batch reaches
+	//layers past the cascades are spot lights, drawn into their atlas tile by the viewport
+	//past the spot lights are point light cube faces, a layer of the point image each
+	vec4 world = model * vec4(v.position, 1.0f);
+	light_offset = vec4(0.0);
+	if (pc.layer < MAX_SHADOW_CASCADES) {
+		gl_Layer = int(pc.layer);
+		gl_Position =  ubo.cascade_view_proj[pc.layer] * world;
+	}
+	else if (pc.layer < POINT_LAYER_BASE) {
+		gl_Layer = 0;
+		gl_Position = ubo.spot_lights[pc.layer - MAX_SHADOW_CASCADES].view_proj * world;
+	}
+	else {
+		uint face = pc.layer - POINT_LAYER_BASE;
+		PointLight light = ubo.point_lights[face / 6];
+		gl_Layer = int(face);
+		gl_Position = light.face_view_proj[face % 6] * world;
+		light_offset = vec4(world.xyz - light.position_range.xyz, light.position_range.w);
+	}
 }